@@ -0,0 +1,315 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 1999-2002 Zbigniew Chyla
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#ifndef LIBPOTOOL_H
+#define LIBPOTOOL_H
+
+/* The po file handling used by potool, as a library. There is no global
+ * state apart from the counters and the mapping switch, so different files
+ * may be parsed, filtered and written by different threads at the same
+ * time. A single PoFile or PoWriter must not be used by two threads at
+ * once, though.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+#include "po-arena.h"
+
+typedef struct {
+	char *str;
+	int num_lines;
+	int *line_lengths;
+} StringBlock;
+
+/* A counted array of strings */
+typedef struct {
+	char **lines;
+	int n;
+} PoLines;
+
+typedef struct {
+	PoLines std, pos, res;
+	PoLines spec;
+} PoComments;
+
+typedef struct {
+	StringBlock *ctx, *id, *id_plural;
+} PoPrevious;
+
+typedef struct {
+	StringBlock *str;
+	int n;
+} MsgStrX;
+
+/* Worked out once, while parsing. */
+typedef enum {
+	PO_FUZZY        = 1 << 0,
+	PO_C_FORMAT     = 1 << 1,
+	PO_TRANSLATED   = 1 << 2,   /* including all the plural forms */
+	PO_HEADER       = 1 << 3,   /* the msgid is empty */
+	PO_OBSOLETE     = 1 << 4
+} PoEntryFlags;
+
+typedef struct {
+	PoComments comments;
+	PoPrevious previous;
+	PoEntryFlags flags;
+	StringBlock *ctx, *id, *id_plural, *str;
+	MsgStrX *msgstrxs;
+	int n_msgstrxs;
+	guint hash;     /* po_entry_hash() of ctx and id */
+	/* where the entry was read from: from its first comment to the end
+	 * of its last string */
+	gsize offset, length;
+	int line;
+} PoEntry;
+
+/* The input file, private to the library */
+typedef struct _PoBuffer PoBuffer;
+
+/* Entries are stored by value, in file order. Their strings and arrays are
+ * allocated from the arena, or point into the buffer or one of the buffers
+ * taken over by po_adopt(). */
+typedef struct {
+	GArray *entries, *obsolete_entries;
+	PoArena *arena;
+	PoBuffer *buffer;
+	GSList *adopted_buffers;
+} PoFile;
+
+#define PO_ERROR po_error_quark ()
+
+typedef enum {
+	PO_ERROR_OPEN,
+	PO_ERROR_READ,
+	PO_ERROR_PARSE,
+	PO_ERROR_CHARSET,
+	PO_ERROR_WRITE
+} PoErrorCode;
+
+GQuark po_error_quark (void);
+
+/* -- filtering -- */
+
+typedef enum {
+	FUZZY_FILTER            = 1 << 0,
+	NOT_FUZZY_FILTER        = 1 << 1,
+	TRANSLATED_FILTER       = 1 << 2,
+	NOT_TRANSLATED_FILTER   = 1 << 3,
+	NOT_TRANSLATED_H_FILTER	= 1 << 4, // same as NOT_TRANSLATED_FILTER but includes msgid "" header
+	OBSOLETE_FILTER         = 1 << 5,
+	NOT_OBSOLETE_FILTER     = 1 << 6,
+} PoFilters;
+
+/* Filters only look at the flags of entries. */
+gboolean po_entry_filter (PoEntry *po, PoFilters filters);
+void po_apply_filters (PoFile *pof, PoFilters filters);
+
+/* -- reading -- */
+
+/* The parts of entries left out by the writer, see po_writer_init(). */
+typedef enum {
+	NO_CTX		= 1 << 0,
+	NO_ID           = 1 << 1,
+	NO_STR          = 1 << 2,
+	NO_STD_COMMENT  = 1 << 3,
+	NO_POS_COMMENT  = 1 << 4,
+	NO_SPEC_COMMENT = 1 << 5,
+	NO_RES_COMMENT  = 1 << 6,
+	NO_PREVIOUS     = 1 << 7,
+	NO_TRANSLATION  = 1 << 8,
+	NO_LINF         = 1 << 9
+} po_write_modes;
+
+/* Called for every entry, in file order. */
+typedef void PoEntryFunc (PoEntry *po, gboolean is_obsolete, gpointer data);
+
+/* File name "-" stands for the standard input. Only entries passing the
+ * filters are kept, the others are dropped as soon as they are parsed. */
+PoFile *po_read (const char *fn, PoFilters filters, GError **error);
+void po_free (PoFile *pof);
+
+/* Makes pof the owner of all the memory of other and frees the rest of it,
+ * so that entries of other may be moved into pof without copying. */
+void po_adopt (PoFile *pof, PoFile *other);
+
+/* Same as po_read(), but uses up to n_threads threads for big files. */
+PoFile *po_read_parallel (const char *fn, int n_threads, PoFilters filters, GError **error);
+
+/* Parses fn, passing every entry to func. Nothing is kept once func
+ * returns, so it has to copy whatever it needs later. The parts in omit are
+ * not put together at all, and are NULL or empty in the entries, as is the
+ * hash without the msgctxt or msgid, but the flags still account for them.
+ * NO_TRANSLATION omits the translations like NO_STR does. */
+gboolean po_parse_stream (const char *fn, PoFilters filters, po_write_modes omit, PoEntryFunc *func, gpointer data, GError **error);
+
+/* Regular files are mapped rather than read, which is quicker, but a file
+ * truncated while it is mapped gets the process killed with SIGBUS. After
+ * po_mapping_disable() they are copied into memory instead, which suits
+ * long running processes reading files that others write in place. It
+ * has to be called before starting any other threads. */
+void po_mapping_disable (void);
+
+StringBlock *stringblock_dup (PoArena *arena, StringBlock *block);
+PoEntry *po_entry_copy (PoArena *arena, PoEntry *ret, PoEntry *po);
+
+/* -- caching -- */
+
+/* Like po_read_parallel(), but keeps the parsed file in cache_dir, from
+ * where it is mapped instead of parsing the file again, for as long as the
+ * file's size, modification time and contents stay the same. The standard
+ * input is never cached, and failing to write the cache is not an error.
+ * Once the file changes, only the entries whose text has changed are parsed
+ * again. */
+PoFile *po_read_cached (const char *fn, const char *cache_dir, int n_threads, PoFilters filters, GError **error);
+
+/* Read a single entry: the nth one, counting from 0 and the obsolete ones
+ * after all the others, or the last non-obsolete one with the given msgctxt,
+ * which may be NULL, and msgid. With an up to date cache, only the entry's
+ * own text is read from the file; otherwise this is po_read_cached(), or
+ * po_read_parallel() without cache_dir. The returned file holds the entry,
+ * or nothing if there is no such entry. */
+PoFile *po_read_entry (const char *fn, const char *cache_dir, int n_threads, int n, GError **error);
+PoFile *po_read_entry_id (const char *fn, const char *cache_dir, int n_threads, const char *ctx, const char *id, GError **error);
+
+/* -- looking up entries -- */
+
+/* Entries are identified by their msgctxt and msgid. */
+typedef struct _PoIndex PoIndex;
+
+guint po_entry_hash (StringBlock *ctx, StringBlock *id);
+
+/* The index points into the array, which must not change while in use. */
+PoIndex *po_index_new (GArray *entries);
+PoEntry *po_index_lookup (PoIndex *index, PoEntry *key);
+void po_index_free (PoIndex *index);
+
+/* -- sharing strings -- */
+
+/* A pool of strings shared by many files, such as the catalogs of the same
+ * template in different languages. The msgctxts, msgids, msgid_plurals and
+ * position comments of the files given to po_intern() are kept in the pool
+ * once for all of them, so they are the same strings exactly when they are
+ * the same pointers. Nothing is removed from the pool before it is freed.
+ * Interning copies every string, so it pays off only for files kept in
+ * memory together and looked up many times, as by the -D server. For one
+ * lookup per entry, PoIndex alone is cheaper.
+ * A pool must not be used by two threads at once. */
+typedef struct _PoPool PoPool;
+
+PoPool *po_pool_new (void);
+/* Moves the strings of pof to the pool, which must outlive pof, and copies
+ * the rest of it, so that its input is freed. A file may be moved to
+ * another pool the same way. */
+void po_intern (PoPool *pool, PoFile *pof);
+/* The number of different strings in the pool. Strings of files since
+ * freed stay in it, so once it grows much bigger than what the files in
+ * use need, they are worth moving to a new pool. */
+guint po_pool_size (PoPool *pool);
+void po_pool_free (PoPool *pool);
+
+/* -- translation memory -- */
+
+/* Translations of similar msgids, from other catalogs. The similarity of
+ * two msgids is 1 less their edit distance divided by the length of the
+ * longer one, so 1 when they are the same. */
+typedef struct _PoMemory PoMemory;
+
+PoMemory *po_memory_new (void);
+/* Remembers the translated, not fuzzy, non-obsolete entries of pof, which
+ * must neither change nor be freed while the memory is in use. */
+void po_memory_add (PoMemory *tm, PoFile *pof);
+/* A remembered entry with the most similar msgid and the same number of
+ * plural forms, the first remembered one of equally similar ones, if its
+ * similarity is at least min_similarity, or NULL. Its similarity is stored
+ * in similarity unless that is NULL. */
+PoEntry *po_memory_lookup (PoMemory *tm, PoEntry *po, double min_similarity, double *similarity);
+/* Gives the untranslated entries of pof the translations of the most
+ * similar remembered ones, marking them fuzzy, with their msgids as the
+ * previous ones. Fuzzy entries get them too, but only if their previous
+ * msgid is less similar. The translations are shared with the remembered
+ * files, which must outlive pof, or be adopted by it. Returns the number of
+ * entries given a translation. */
+int po_memory_suggest (PoMemory *tm, PoFile *pof, double min_similarity);
+void po_memory_free (PoMemory *tm);
+
+/* -- charsets -- */
+
+/* The first non-obsolete entry with an empty msgid, or NULL. */
+PoEntry *po_file_header (PoFile *pof);
+/* The charset given in the header's Content-Type, or NULL; free with
+ * g_free(). */
+char *po_entry_charset (PoEntry *header);
+
+/* Converts entries from one charset to another, rewriting the charset in
+ * the header entry. */
+typedef struct _PoRecoder PoRecoder;
+
+PoRecoder *po_recoder_new (const char *from, const char *to, GError **error);
+/* The converted strings are allocated from arena. */
+gboolean po_recode_entry (PoRecoder *rc, PoArena *arena, PoEntry *po, GError **error);
+void po_recoder_free (PoRecoder *rc);
+/* Converts the whole file from the charset of its header. */
+gboolean po_recode_file (PoFile *pof, const char *to, GError **error);
+
+/* -- writing -- */
+
+/* Writer state, kept between entries so that they can be written one by
+ * one, as they are parsed. Output is collected in a buffer and written in
+ * big blocks, optionally by a separate thread. Once writing fails, nothing
+ * more is written and error holds the errno value, which is only certain
+ * to be up to date after po_writer_finish().
+ */
+typedef struct _PoWriterThread PoWriterThread;
+
+typedef struct {
+	FILE *out;
+	po_write_modes mode;
+	gboolean preserve_wrapping;
+	gboolean wrote_entry;   /* whether a non-obsolete entry was written */
+	int error;
+	char *buf;
+	gsize buf_len;
+	PoWriterThread *thread;
+} PoWriter;
+
+void po_writer_init (PoWriter *pw, FILE *out, po_write_modes mode, gboolean preserve_wrapping);
+/* Makes a separate thread do the writing, while the next block is being
+ * formatted. */
+void po_writer_start_thread (PoWriter *pw);
+/* Writes out everything, including the stdio buffer of out, and frees the
+ * writer's resources. */
+void po_writer_finish (PoWriter *pw);
+void po_write_entry (PoWriter *pw, PoEntry *po, gboolean is_obsolete);
+void po_write (PoWriter *pw, PoFile *pof);
+
+/* -- compiling -- */
+
+/* Writes the binary catalog read by gettext, like msgfmt does: only the
+ * translated entries, without the fuzzy ones, except for the header. The
+ * last of several entries with the same msgctxt and msgid is used. */
+gboolean po_write_mo (PoFile *pof, const char *fn, GError **error);
+
+/* -- counting -- */
+
+/* Totals of the work done by the library, in all threads, for finding out
+ * where the time goes. Input and cache files count as read, output, cache
+ * and MO files as written. The allocations are those from arenas, which
+ * are made of bigger chunks. Nothing is counted before po_counters_enable(),
+ * which has to be called before starting any other threads. */
+typedef struct {
+	guint64 bytes_read, bytes_written;
+	guint64 tokens;
+	guint64 entries_parsed, entries_kept;
+	guint64 allocs, alloc_bytes, alloc_chunks;
+} PoCounters;
+
+void po_counters_enable (void);
+/* Arenas only add theirs once cleared or freed. */
+void po_counters_get (PoCounters *counters);
+
+#endif /* LIBPOTOOL_H */
@@ -0,0 +1,176 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#include <string.h>
+#include <glib.h>
+#include "po-arena.h"
+#include "po-gram.h"
+
+#define ARENA_ALIGN (2 * sizeof (gpointer))
+#define ARENA_MIN_CHUNK (64 * 1024)
+#define ARENA_MAX_CHUNK (1024 * 1024)
+
+typedef struct _PoArenaChunk PoArenaChunk;
+
+struct _PoArenaChunk {
+	PoArenaChunk *next;
+	gsize size, used;
+	/* data follows, aligned to ARENA_ALIGN */
+};
+
+struct _PoArena {
+	PoArenaChunk *chunks;   /* the first one is the one we allocate from */
+	gsize next_chunk_size;
+	PoCounters counted;     /* only the allocation counts, see po_arena_count() */
+};
+
+#define CHUNK_HEADER_SIZE ((sizeof (PoArenaChunk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define CHUNK_DATA(c) ((char *) (c) + CHUNK_HEADER_SIZE)
+
+static PoArenaChunk *
+chunk_new (PoArena *arena, gsize size)
+{
+	PoArenaChunk *c = g_malloc (CHUNK_HEADER_SIZE + size);
+	arena->counted.alloc_chunks++;
+	c->next = NULL;
+	c->size = size;
+	c->used = 0;
+	return c;
+}
+
+PoArena *
+po_arena_new (void)
+{
+	PoArena *arena = g_new (PoArena, 1);
+	arena->chunks = NULL;
+	arena->next_chunk_size = ARENA_MIN_CHUNK;
+	memset (&arena->counted, 0, sizeof arena->counted);
+	return arena;
+}
+
+/* Hands over what was allocated so far to the library's counters. */
+static void
+po_arena_count (PoArena *arena)
+{
+	po_counters_add (&arena->counted);
+	memset (&arena->counted, 0, sizeof arena->counted);
+}
+
+void
+po_arena_free (PoArena *arena)
+{
+	PoArenaChunk *c, *next;
+
+	if (arena == NULL)
+		return;
+	po_arena_count (arena);
+	for (c = arena->chunks; c != NULL; c = next) {
+		next = c->next;
+		g_free (c);
+	}
+	g_free (arena);
+}
+
+/* Releases all allocations, but keeps the most recent chunk for reuse. */
+void
+po_arena_clear (PoArena *arena)
+{
+	PoArenaChunk *c, *next;
+
+	po_arena_count (arena);
+	if (arena->chunks == NULL)
+		return;
+	for (c = arena->chunks->next; c != NULL; c = next) {
+		next = c->next;
+		g_free (c);
+	}
+	arena->chunks->next = NULL;
+	arena->chunks->used = 0;
+}
+
+/* Moves everything allocated from other into arena, and frees other. */
+void
+po_arena_adopt (PoArena *arena, PoArena *other)
+{
+	PoArenaChunk *tail;
+
+	if (other->chunks != NULL) {
+		for (tail = other->chunks; tail->next != NULL; tail = tail->next)
+			;
+		if (arena->chunks != NULL) {
+			/* keep allocating from our current chunk */
+			tail->next = arena->chunks->next;
+			arena->chunks->next = other->chunks;
+		} else {
+			arena->chunks = other->chunks;
+		}
+	}
+	arena->counted.allocs += other->counted.allocs;
+	arena->counted.alloc_bytes += other->counted.alloc_bytes;
+	arena->counted.alloc_chunks += other->counted.alloc_chunks;
+	g_free (other);
+}
+
+gpointer
+po_arena_alloc (PoArena *arena, gsize size)
+{
+	PoArenaChunk *c = arena->chunks;
+	gpointer ret;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	arena->counted.allocs++;
+	arena->counted.alloc_bytes += size;
+	if (c == NULL || c->size - c->used < size) {
+		if (size > arena->next_chunk_size / 4) {
+			/* Big allocations get a chunk of their own, which is put
+			 * behind the current one so that its free space is not lost. */
+			PoArenaChunk *big = chunk_new (arena, size);
+			big->used = size;
+			if (c != NULL) {
+				big->next = c->next;
+				c->next = big;
+			} else {
+				arena->chunks = big;
+			}
+			return CHUNK_DATA (big);
+		}
+		c = chunk_new (arena, arena->next_chunk_size);
+		c->next = arena->chunks;
+		arena->chunks = c;
+		if (arena->next_chunk_size < ARENA_MAX_CHUNK)
+			arena->next_chunk_size *= 2;
+	}
+	ret = CHUNK_DATA (c) + c->used;
+	c->used += size;
+	return ret;
+}
+
+gchar *
+po_arena_strndup (PoArena *arena, const gchar *str, gsize len)
+{
+	gchar *ret = po_arena_alloc (arena, len + 1);
+	memcpy (ret, str, len);
+	ret[len] = '\0';
+	return ret;
+}
+
+gchar *
+po_arena_strdup (PoArena *arena, const gchar *str)
+{
+	if (str == NULL)
+		return NULL;
+	return po_arena_strndup (arena, str, strlen (str));
+}
+
+GSList *
+po_arena_slist_prepend (PoArena *arena, GSList *list, gpointer data)
+{
+	GSList *node = po_arena_new_struct (arena, GSList, 1);
+	node->data = data;
+	node->next = list;
+	return node;
+}
+
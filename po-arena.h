@@ -0,0 +1,35 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#ifndef PO_ARENA_H
+#define PO_ARENA_H
+
+#include <glib.h>
+
+/* A bump allocator. Everything allocated from an arena is released at once
+ * by po_arena_free(), there is no way to free individual allocations.
+ */
+typedef struct _PoArena PoArena;
+
+PoArena *po_arena_new (void);
+void po_arena_free (PoArena *arena);
+void po_arena_clear (PoArena *arena);
+void po_arena_adopt (PoArena *arena, PoArena *other);
+
+gpointer po_arena_alloc (PoArena *arena, gsize size);
+gchar *po_arena_strndup (PoArena *arena, const gchar *str, gsize len);
+gchar *po_arena_strdup (PoArena *arena, const gchar *str);
+
+#define po_arena_new_struct(arena, struct_type, n_structs) \
+	((struct_type *) po_arena_alloc ((arena), sizeof (struct_type) * (n_structs)))
+
+/* Prepends a GSList node allocated from the arena. Lists built this way must
+ * never be passed to g_slist_free() or other functions that free or allocate
+ * nodes.
+ */
+GSList *po_arena_slist_prepend (PoArena *arena, GSList *list, gpointer data);
+
+#endif /* PO_ARENA_H */
@@ -0,0 +1,205 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include "po-gram.h"
+#include "i18n.h"
+
+/* Returns a file descriptor for reading fn, "-" being the standard input,
+ * or -1 on failure. */
+int
+po_input_open (const char *fn, GError **error)
+{
+	int fd;
+
+	if (strcmp (fn, "-") == 0)
+		return STDIN_FILENO;
+	if ((fd = open (fn, O_RDONLY)) < 0) {
+		g_set_error (error, PO_ERROR, PO_ERROR_OPEN,
+		             _("Can't open input file: %s"), fn);
+	}
+	return fd;
+}
+
+static gboolean mapping_disabled;
+
+void
+po_mapping_disable (void)
+{
+	mapping_disabled = TRUE;
+}
+
+/* Reads the size bytes of a regular file from its beginning. pread()
+ * leaves the file offset alone, as mapping does. A file truncated in the
+ * meantime just ends early. */
+static PoBuffer *
+po_buffer_copy (int fd, gsize size)
+{
+	PoBuffer *buf = po_buffer_new (size);
+	gsize len = 0;
+
+	while (len < size) {
+		ssize_t ret = pread (fd, buf->data + len, size - len, len);
+
+		if (ret == 0)
+			break;
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			po_buffer_free (buf);
+			return NULL;
+		}
+		len += ret;
+	}
+	memset (buf->data + len, 0, PO_BUFFER_PADDING);
+	buf->len = len;
+	po_count_read (len);
+	return buf;
+}
+
+/* Reserves room for the file and the NULs which flex wants at the end of the
+ * buffer, then maps the file over the beginning of that space. The mapping
+ * is private and writable, since the scanner terminates tokens in place.
+ * Returns NULL if fd is not a non-empty regular file, or can't be mapped.
+ * After po_mapping_disable() the file is copied instead.
+ */
+PoBuffer *
+po_buffer_map (int fd)
+{
+	gsize page = sysconf (_SC_PAGESIZE);
+	gsize size, map_len;
+	struct stat st;
+	PoBuffer *buf;
+	char *base;
+
+	if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) || st.st_size == 0)
+		return NULL;
+	size = st.st_size;
+	if (mapping_disabled)
+		return po_buffer_copy (fd, size);
+	map_len = (size + PO_BUFFER_PADDING + page - 1) / page * page;
+	base = mmap (NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+	if (mmap (base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap (base, map_len);
+		return NULL;
+	}
+	madvise (base, size, MADV_SEQUENTIAL);
+	po_count_read (size);
+	buf = g_new (PoBuffer, 1);
+	buf->data = base;
+	buf->len = size;
+	buf->map_len = map_len;
+	buf->discarded = 0;
+	return buf;
+}
+
+/* Fallback for pipes, terminals and anything else we can't map. */
+static PoBuffer *
+po_buffer_slurp (int fd, const char *fn, GError **error)
+{
+	PoBuffer *buf;
+	gsize size = 64 * 1024, len = 0;
+	char *data = g_malloc (size);
+
+	for (;;) {
+		ssize_t ret;
+
+		if (size - len < PO_BUFFER_PADDING + 1) {
+			size *= 2;
+			data = g_realloc (data, size);
+		}
+		ret = read (fd, data + len, size - len - PO_BUFFER_PADDING);
+		if (ret == 0)
+			break;
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			g_set_error (error, PO_ERROR, PO_ERROR_READ,
+			             _("Can't read input file %s: %s"), fn, g_strerror (errno));
+			g_free (data);
+			return NULL;
+		}
+		len += ret;
+	}
+	memset (data + len, 0, PO_BUFFER_PADDING);
+	po_count_read (len);
+	buf = g_new (PoBuffer, 1);
+	buf->data = data;
+	buf->len = len;
+	buf->map_len = 0;
+	buf->discarded = 0;
+	return buf;
+}
+
+PoBuffer *
+po_buffer_read (const char *fn, GError **error)
+{
+	PoBuffer *buf;
+	int fd = po_input_open (fn, error);
+
+	if (fd < 0)
+		return NULL;
+	if ((buf = po_buffer_map (fd)) == NULL) {
+		buf = po_buffer_slurp (fd, fn, error);
+	}
+	if (fd != STDIN_FILENO)
+		close (fd);
+	return buf;
+}
+
+/* An empty buffer for len bytes, which the caller fills in. */
+PoBuffer *
+po_buffer_new (gsize len)
+{
+	PoBuffer *buf = g_new (PoBuffer, 1);
+
+	buf->data = g_malloc (len + PO_BUFFER_PADDING);
+	memset (buf->data + len, 0, PO_BUFFER_PADDING);
+	buf->len = len;
+	buf->map_len = 0;
+	buf->discarded = 0;
+	return buf;
+}
+
+/* Tells the system that the mapped input before upto is not going to be
+ * used anymore, so that the pages we have written to can be dropped. They
+ * would be read again from the file if they were accessed later. */
+void
+po_buffer_discard (PoBuffer *buf, const char *upto)
+{
+	gsize page = sysconf (_SC_PAGESIZE);
+	gsize end;
+
+	if (buf->map_len == 0)
+		return;
+	end = (upto - buf->data) / page * page;
+	if (end > buf->discarded) {
+		madvise (buf->data + buf->discarded, end - buf->discarded, MADV_DONTNEED);
+		buf->discarded = end;
+	}
+}
+
+void
+po_buffer_free (PoBuffer *buf)
+{
+	if (buf == NULL)
+		return;
+	if (buf->map_len != 0) {
+		munmap (buf->data, buf->map_len);
+	} else {
+		g_free (buf->data);
+	}
+	g_free (buf);
+}
@@ -0,0 +1,1005 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include "po-gram.h"
+
+/* A cache file is an image of the parsed PoFile, mapped and fixed up in
+ * place. After the header come the entries and everything else holding
+ * pointers, which are stored as offsets from the start of the file (0 for
+ * NULL), and then the strings, with offsets from the start of the string
+ * area. Only the first part is written to when the pointers are fixed up.
+ * The layout is that of the structs in memory, so a cache is only valid
+ * for the build of potool which wrote it. A checksum of everything after
+ * the header, and checks of every offset and count before they are
+ * followed, keep a damaged cache from being used.
+ *
+ * Entries know where they were found in the po file. Together with hashes
+ * of their text, kept in the cache as well, this is enough to parse only
+ * the changed parts of a file again, see cache_update(), or to read a
+ * single entry without parsing the rest, see po_read_entry().
+ */
+#define PO_CACHE_MAGIC "potool\0c"
+#define PO_CACHE_VERSION 3
+
+/* The text from the start of an entry up to the next one, or for the first
+ * entry from the start of the file, see cache_span_bounds(). */
+typedef struct {
+	guint64 hash;
+	guint64 head;           /* hash of the first SPAN_HEAD bytes */
+} PoCacheSpan;
+
+#define SPAN_HEAD 64
+
+typedef struct {
+	char magic[8];
+	guint32 version;
+	guint32 abi;            /* sizes of the structs, see cache_abi() */
+	/* the po file */
+	guint64 dev, ino, size;
+	gint64 mtime_sec, mtime_nsec;
+	guint64 hash;
+	/* the cache file */
+	guint64 entries, n_entries;
+	guint64 obsolete_entries, n_obsolete_entries;
+	guint64 spans;          /* one for each entry, obsolete ones last */
+	guint64 strings, len;
+	guint64 checksum;       /* cache_hash() of the rest of the file */
+} PoCacheHeader;
+
+static guint32
+cache_abi (void)
+{
+	return sizeof (PoEntry) | sizeof (StringBlock) << 10 | sizeof (MsgStrX) << 20 |
+	       (sizeof (gpointer) == 8) << 30;
+}
+
+/* Not a cryptographic hash, but enough to tell when a file has been changed
+ * without its size and modification time changing. Four lanes keep the
+ * multiplications independent of each other, so that it is not much slower
+ * than reading the file. */
+static guint64
+cache_hash (const char *data, gsize len)
+{
+	const guint64 k = G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+	guint64 h[4] = { len, len ^ 1, len ^ 2, len ^ 3 }, w;
+	const char *end = data + len;
+	int i;
+
+	for (; end - data >= 32; data += 32) {
+		for (i = 0; i < 4; i++) {
+			memcpy (&w, data + i * 8, 8);
+			h[i] = (h[i] ^ w) * k;
+			h[i] ^= h[i] >> 29;
+		}
+	}
+	for (i = 0; data < end; data++, i = (i + 1) % 4) {
+		h[i] = (h[i] ^ (guchar) *data) * k;
+	}
+	for (i = 1; i < 4; i++) {
+		h[0] = (h[0] ^ h[i]) * k;
+		h[0] ^= h[0] >> 29;
+	}
+	return h[0];
+}
+
+/* Maps a po file and fills in the part of hdr describing it: its stat and
+ * content hash. Returns NULL if the file can't be cached. */
+static PoBuffer *
+cache_map_source (const char *fn, PoCacheHeader *hdr)
+{
+	struct stat st;
+	PoBuffer *buf;
+	int fd;
+
+	if (strcmp (fn, "-") == 0 || (fd = open (fn, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat (fd, &st) != 0 || (buf = po_buffer_map (fd)) == NULL) {
+		close (fd);
+		return NULL;
+	}
+	close (fd);
+	memset (hdr, 0, sizeof *hdr);
+	memcpy (hdr->magic, PO_CACHE_MAGIC, sizeof hdr->magic);
+	hdr->version = PO_CACHE_VERSION;
+	hdr->abi = cache_abi ();
+	hdr->dev = st.st_dev;
+	hdr->ino = st.st_ino;
+	hdr->size = buf->len;
+	hdr->mtime_sec = st.st_mtim.tv_sec;
+	hdr->mtime_nsec = st.st_mtim.tv_nsec;
+	hdr->hash = cache_hash (buf->data, buf->len);
+	return buf;
+}
+
+/* The cache of a file is named after a hash of its absolute name. */
+static char *
+cache_file_name (const char *fn, const char *cache_dir)
+{
+	char path[PATH_MAX], name[32];
+	guint64 h = 14695981039346656037ULL;
+	const char *s;
+
+	if (realpath (fn, path) == NULL)
+		return NULL;
+	for (s = path; *s != '\0'; s++) {
+		h = (h ^ (guchar) *s) * 1099511628211ULL;
+	}
+	g_snprintf (name, sizeof name, "%016" G_GINT64_MODIFIER "x.poc", h);
+	return g_build_filename (cache_dir, name, NULL);
+}
+
+/* Entries of both tables, in file order. */
+static PoEntry *
+cache_nth_entry (PoFile *pof, int i)
+{
+	if (i < pof->entries->len)
+		return &g_array_index (pof->entries, PoEntry, i);
+	return &g_array_index (pof->obsolete_entries, PoEntry, i - pof->entries->len);
+}
+
+/* Where the span of entry i is, in a file of len bytes. */
+static void
+cache_span_bounds (PoFile *pof, int i, gsize len, gsize *start, gsize *end)
+{
+	int n = pof->entries->len + pof->obsolete_entries->len;
+
+	*start = i == 0 ? 0 : cache_nth_entry (pof, i)->offset;
+	*end = i + 1 < n ? cache_nth_entry (pof, i + 1)->offset : len;
+}
+
+/* --- writing --- */
+
+typedef struct {
+	GString *meta, *strings;
+} PoCacheWriter;
+
+static void
+cache_align (PoCacheWriter *cw)
+{
+	while (cw->meta->len % sizeof (gpointer) != 0)
+		g_string_append_c (cw->meta, '\0');
+}
+
+/* Returns the offset of a copy of len bytes at p, aligned for pointers. */
+static guint64
+cache_put (PoCacheWriter *cw, gconstpointer p, gsize len)
+{
+	guint64 off;
+
+	cache_align (cw);
+	off = cw->meta->len;
+	g_string_append_len (cw->meta, p, len);
+	return off;
+}
+
+static guint64
+cache_put_string (PoCacheWriter *cw, const char *s)
+{
+	guint64 off = cw->strings->len;
+
+	g_string_append_len (cw->strings, s, strlen (s) + 1);
+	return off;
+}
+
+/* Offsets are stored in pointers, so they are handed back as such. */
+#define OFFSET_PTR(off) ((gpointer) (guintptr) (off))
+#define PTR_OFFSET(p) ((guint64) (guintptr) (p))
+
+static StringBlock *
+cache_put_block (PoCacheWriter *cw, StringBlock *block)
+{
+	StringBlock copy;
+
+	if (block == NULL)
+		return NULL;
+	copy.str = OFFSET_PTR (cache_put_string (cw, block->str));
+	copy.num_lines = block->num_lines;
+	copy.line_lengths = OFFSET_PTR (cache_put (cw, block->line_lengths, block->num_lines * sizeof (int)));
+	return OFFSET_PTR (cache_put (cw, &copy, sizeof copy));
+}
+
+static void
+cache_put_lines (PoCacheWriter *cw, PoLines *lines)
+{
+	char **offsets;
+	int i;
+
+	if (lines->n == 0) {
+		lines->lines = NULL;
+		return;
+	}
+	offsets = g_new (char *, lines->n);
+	for (i = 0; i < lines->n; i++) {
+		offsets[i] = OFFSET_PTR (cache_put_string (cw, lines->lines[i]));
+	}
+	lines->lines = OFFSET_PTR (cache_put (cw, offsets, lines->n * sizeof (char *)));
+	g_free (offsets);
+}
+
+/* Entries are copied out first and stored last, as their own pointers are
+ * replaced along the way. */
+static guint64
+cache_put_entries (PoCacheWriter *cw, GArray *table)
+{
+	PoEntry *copies = g_new (PoEntry, table->len);
+	guint64 off;
+	int i, j;
+
+	if (table->len > 0)
+		memcpy (copies, table->data, table->len * sizeof (PoEntry));
+	for (i = 0; i < table->len; i++) {
+		PoEntry *po = &copies[i];
+
+		cache_put_lines (cw, &po->comments.std);
+		cache_put_lines (cw, &po->comments.pos);
+		cache_put_lines (cw, &po->comments.res);
+		cache_put_lines (cw, &po->comments.spec);
+		po->previous.ctx = cache_put_block (cw, po->previous.ctx);
+		po->previous.id = cache_put_block (cw, po->previous.id);
+		po->previous.id_plural = cache_put_block (cw, po->previous.id_plural);
+		po->ctx = cache_put_block (cw, po->ctx);
+		po->id = cache_put_block (cw, po->id);
+		po->id_plural = cache_put_block (cw, po->id_plural);
+		po->str = cache_put_block (cw, po->str);
+		if (po->n_msgstrxs > 0) {
+			MsgStrX *m = g_new (MsgStrX, po->n_msgstrxs);
+
+			for (j = 0; j < po->n_msgstrxs; j++) {
+				m[j].n = po->msgstrxs[j].n;
+				m[j].str = cache_put_block (cw, po->msgstrxs[j].str);
+			}
+			po->msgstrxs = OFFSET_PTR (cache_put (cw, m, po->n_msgstrxs * sizeof (MsgStrX)));
+			g_free (m);
+		} else {
+			po->msgstrxs = NULL;
+		}
+	}
+	off = cache_put (cw, copies, table->len * sizeof (PoEntry));
+	g_free (copies);
+	return off;
+}
+
+static gboolean
+write_all (int fd, const char *s, gsize len)
+{
+	while (len > 0) {
+		ssize_t ret = write (fd, s, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return FALSE;
+		po_count_written (ret);
+		s += ret;
+		len -= ret;
+	}
+	return TRUE;
+}
+
+static guint64
+cache_put_spans (PoCacheWriter *cw, PoFile *pof, const char *data, gsize len)
+{
+	int i, n = pof->entries->len + pof->obsolete_entries->len;
+	PoCacheSpan *spans = g_new (PoCacheSpan, n);
+	gsize start, end;
+	guint64 off;
+
+	for (i = 0; i < n; i++) {
+		cache_span_bounds (pof, i, len, &start, &end);
+		spans[i].hash = cache_hash (data + start, end - start);
+		spans[i].head = cache_hash (data + start, MIN (end - start, SPAN_HEAD));
+	}
+	off = cache_put (cw, spans, n * sizeof (PoCacheSpan));
+	g_free (spans);
+	return off;
+}
+
+/* Writes to a temporary file which replaces the old cache, so that other
+ * processes only ever see a complete one. data is the po file which pof
+ * was read from. */
+static void
+cache_write (PoFile *pof, PoCacheHeader *hdr, const char *data, const char *cache_fn, const char *cache_dir)
+{
+	PoCacheWriter cw;
+	char *tmp_fn;
+	gboolean ok;
+	int fd;
+
+	if (g_mkdir_with_parents (cache_dir, 0777) != 0)
+		return;
+	cw.meta = g_string_sized_new (64 * 1024);
+	cw.strings = g_string_sized_new (64 * 1024);
+	g_string_append_len (cw.meta, (char *) hdr, sizeof *hdr);
+	hdr->entries = cache_put_entries (&cw, pof->entries);
+	hdr->n_entries = pof->entries->len;
+	hdr->obsolete_entries = cache_put_entries (&cw, pof->obsolete_entries);
+	hdr->n_obsolete_entries = pof->obsolete_entries->len;
+	hdr->spans = cache_put_spans (&cw, pof, data, hdr->size);
+	cache_align (&cw);
+	hdr->strings = cw.meta->len;
+	g_string_append_len (cw.meta, cw.strings->str, cw.strings->len);
+	hdr->len = cw.meta->len;
+	hdr->checksum = cache_hash (cw.meta->str + sizeof *hdr, cw.meta->len - sizeof *hdr);
+	memcpy (cw.meta->str, hdr, sizeof *hdr);
+
+	tmp_fn = g_strconcat (cache_fn, ".XXXXXX", NULL);
+	if ((fd = mkstemp (tmp_fn)) >= 0) {
+		ok = write_all (fd, cw.meta->str, cw.meta->len);
+		ok = close (fd) == 0 && ok;
+		if (!ok || rename (tmp_fn, cache_fn) != 0)
+			unlink (tmp_fn);
+	}
+	g_free (tmp_fn);
+	g_string_free (cw.meta, TRUE);
+	g_string_free (cw.strings, TRUE);
+}
+
+/* --- reading --- */
+
+/* Whether the parts of the cache file which the header points to are
+ * where they can be: the pointer part after the header, and the strings
+ * after it, up to the end of the file, which ends a string. */
+static gboolean
+cache_header_ok (PoCacheHeader *chdr, gsize len)
+{
+	guint64 n = chdr->n_entries + chdr->n_obsolete_entries;
+
+	return chdr->len == len && chdr->strings >= sizeof *chdr && chdr->strings <= len &&
+	       (chdr->strings == len || ((char *) chdr)[len - 1] == '\0') &&
+	       n >= chdr->n_entries && n <= G_MAXINT;
+}
+
+/* Whether n items of size bytes at off are within the pointer part. All
+ * of them are aligned for pointers, see cache_put(). */
+static gboolean
+cache_range_ok (PoCacheHeader *chdr, guint64 off, guint64 n, gsize size)
+{
+	return off >= sizeof *chdr && off % sizeof (gpointer) == 0 &&
+	       off <= chdr->strings && n <= (chdr->strings - off) / size;
+}
+
+typedef struct {
+	PoCacheHeader *chdr;
+	char *base, *strings;
+	guint64 strings_len;
+	gboolean ok;            /* whether everything so far was in bounds */
+} PoCacheReader;
+
+/* The fixed up pointer for n items of size bytes at offset p, or NULL if
+ * they are not all within the file. */
+static gpointer
+cache_get (PoCacheReader *cr, gpointer p, guint64 n, gsize size)
+{
+	if (!cache_range_ok (cr->chdr, PTR_OFFSET (p), n, size)) {
+		cr->ok = FALSE;
+		return NULL;
+	}
+	return cr->base + PTR_OFFSET (p);
+}
+
+static char *
+cache_get_string (PoCacheReader *cr, char *p)
+{
+	if (PTR_OFFSET (p) >= cr->strings_len) {
+		cr->ok = FALSE;
+		return NULL;
+	}
+	return cr->strings + PTR_OFFSET (p);
+}
+
+/* The lines of a block have to add up to its string. */
+static StringBlock *
+cache_get_block (PoCacheReader *cr, StringBlock *block)
+{
+	guint64 off, len = 0;
+	int i;
+
+	if (block == NULL || (block = cache_get (cr, block, 1, sizeof *block)) == NULL)
+		return NULL;
+	off = PTR_OFFSET (block->str);
+	if (block->num_lines < 0 ||
+	    (block->str = cache_get_string (cr, block->str)) == NULL ||
+	    (block->line_lengths = cache_get (cr, block->line_lengths, block->num_lines, sizeof (int))) == NULL)
+		return NULL;
+	for (i = 0; i < block->num_lines; i++) {
+		if (block->line_lengths[i] < 0)
+			break;
+		len += block->line_lengths[i];
+	}
+	if (i < block->num_lines || len >= cr->strings_len - off || block->str[len] != '\0') {
+		cr->ok = FALSE;
+		return NULL;
+	}
+	return block;
+}
+
+static void
+cache_get_lines (PoCacheReader *cr, PoLines *lines)
+{
+	int i;
+
+	if (lines->n == 0)
+		return;
+	if (lines->n < 0 || (lines->lines = cache_get (cr, lines->lines, lines->n, sizeof (char *))) == NULL) {
+		cr->ok = FALSE;
+		lines->n = 0;
+		return;
+	}
+	for (i = 0; i < lines->n; i++) {
+		lines->lines[i] = cache_get_string (cr, lines->lines[i]);
+	}
+}
+
+static GArray *
+cache_get_entries (PoCacheReader *cr, guint64 off, guint64 n)
+{
+	GArray *table;
+	PoEntry *po, *end;
+	int i;
+
+	if (!cache_range_ok (cr->chdr, off, n, sizeof (PoEntry))) {
+		cr->ok = FALSE;
+		return g_array_new (FALSE, FALSE, sizeof (PoEntry));
+	}
+	table = g_array_sized_new (FALSE, FALSE, sizeof (PoEntry), n);
+	g_array_append_vals (table, cr->base + off, n);
+	for (po = (PoEntry *) table->data, end = po + n; cr->ok && po < end; po++) {
+		cache_get_lines (cr, &po->comments.std);
+		cache_get_lines (cr, &po->comments.pos);
+		cache_get_lines (cr, &po->comments.res);
+		cache_get_lines (cr, &po->comments.spec);
+		po->previous.ctx = cache_get_block (cr, po->previous.ctx);
+		po->previous.id = cache_get_block (cr, po->previous.id);
+		po->previous.id_plural = cache_get_block (cr, po->previous.id_plural);
+		po->ctx = cache_get_block (cr, po->ctx);
+		po->id = cache_get_block (cr, po->id);
+		po->id_plural = cache_get_block (cr, po->id_plural);
+		po->str = cache_get_block (cr, po->str);
+		if (po->id == NULL)
+			cr->ok = FALSE;
+		if (po->msgstrxs != NULL) {
+			if (po->n_msgstrxs < 0 ||
+			    (po->msgstrxs = cache_get (cr, po->msgstrxs, po->n_msgstrxs, sizeof (MsgStrX))) == NULL) {
+				cr->ok = FALSE;
+				po->n_msgstrxs = 0;
+			}
+			for (i = 0; i < po->n_msgstrxs; i++) {
+				po->msgstrxs[i].str = cache_get_block (cr, po->msgstrxs[i].str);
+			}
+		}
+	}
+	return table;
+}
+
+/* Entries have to be in file order, within the file, for their spans. */
+static gboolean
+cache_offsets_ok (PoFile *pof, guint64 size)
+{
+	int i, n = pof->entries->len + pof->obsolete_entries->len;
+	gsize last = 0;
+
+	for (i = 0; i < n; i++) {
+		PoEntry *po = cache_nth_entry (pof, i);
+
+		if (po->offset < last || po->offset > size || po->length > size - po->offset)
+			return FALSE;
+		last = po->offset;
+	}
+	return TRUE;
+}
+
+/* Maps the cache file, if it is there and matches the po file. Given
+ * stale, a cache of another version of the file is returned as well, and
+ * *stale set. */
+static PoFile *
+cache_read (PoCacheHeader *hdr, const char *cache_fn, gboolean *stale)
+{
+	PoCacheHeader *chdr;
+	PoCacheReader cr;
+	PoBuffer *buf;
+	PoFile *pof;
+	struct stat st;
+	char *base;
+	int fd;
+
+	if ((fd = open (cache_fn, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat (fd, &st) != 0 || st.st_size < sizeof (PoCacheHeader)) {
+		close (fd);
+		return NULL;
+	}
+	base = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (base == MAP_FAILED)
+		return NULL;
+	po_count_read (st.st_size);
+	chdr = (PoCacheHeader *) base;
+	if (memcmp (chdr->magic, hdr->magic, sizeof hdr->magic) != 0 ||
+	    chdr->version != hdr->version || chdr->abi != hdr->abi ||
+	    !cache_header_ok (chdr, st.st_size) ||
+	    !cache_range_ok (chdr, chdr->spans, chdr->n_entries + chdr->n_obsolete_entries, sizeof (PoCacheSpan)) ||
+	    chdr->checksum != cache_hash (base + sizeof *chdr, st.st_size - sizeof *chdr)) {
+		munmap (base, st.st_size);
+		return NULL;
+	}
+	if (chdr->dev != hdr->dev || chdr->ino != hdr->ino || chdr->size != hdr->size ||
+	    chdr->mtime_sec != hdr->mtime_sec || chdr->mtime_nsec != hdr->mtime_nsec ||
+	    chdr->hash != hdr->hash) {
+		if (stale == NULL) {
+			munmap (base, st.st_size);
+			return NULL;
+		}
+		*stale = TRUE;
+	}
+	cr.chdr = chdr;
+	cr.base = base;
+	cr.strings = base + chdr->strings;
+	cr.strings_len = st.st_size - chdr->strings;
+	cr.ok = TRUE;
+	buf = g_new0 (PoBuffer, 1);
+	buf->data = base;
+	buf->len = buf->map_len = st.st_size;
+	pof = g_new (PoFile, 1);
+	pof->arena = po_arena_new ();
+	pof->buffer = buf;
+	pof->adopted_buffers = NULL;
+	pof->entries = cache_get_entries (&cr, chdr->entries, chdr->n_entries);
+	pof->obsolete_entries = cache_get_entries (&cr, chdr->obsolete_entries, chdr->n_obsolete_entries);
+	if (!cr.ok || !cache_offsets_ok (pof, chdr->size)) {
+		po_free (pof);
+		return NULL;
+	}
+	return pof;
+}
+
+/* --- updating --- */
+
+/* A part of the new version of a file: either the span of an entry of the
+ * old version, or text which has to be parsed. */
+typedef struct {
+	gsize start, end;
+	int span;               /* -1 for new text */
+} PoCachePiece;
+
+static void
+add_piece (GArray *pieces, gsize start, gsize end, int span)
+{
+	PoCachePiece piece = { start, end, span };
+
+	if (end > start)
+		g_array_append_val (pieces, piece);
+}
+
+static int
+count_lines (const char *s, gsize len)
+{
+	const char *end = s + len;
+	int n = 0;
+
+	while ((s = memchr (s, '\n', end - s)) != NULL) {
+		s++;
+		n++;
+	}
+	return n;
+}
+
+static gboolean
+is_blank (const char *s, gsize len)
+{
+	for (; len > 0; s++, len--) {
+		if (strchr (" \t\v\f\n", *s) == NULL || *s == '\0')
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* Splits the new version of the file, data, into spans of the old one,
+ * which come in the same order, and the text between them. The next span
+ * is looked for at the start of every line, and where it isn't found, the
+ * spans beginning with the same SPAN_HEAD bytes as the line. Returns NULL
+ * if so little is left that parsing the whole file would be quicker. */
+static GArray *
+cache_match (PoFile *old, const char *data, gsize len)
+{
+	PoCacheHeader *chdr = (PoCacheHeader *) old->buffer->data;
+	PoCacheSpan *spans = (PoCacheSpan *) (old->buffer->data + chdr->spans);
+	int i = 0, k, n = chdr->n_entries + chdr->n_obsolete_entries;
+	GArray *pieces = g_array_new (FALSE, FALSE, sizeof (PoCachePiece));
+	GHashTable *heads = g_hash_table_new (g_int64_hash, g_int64_equal);
+	int *next_same = g_new (int, n);
+	gsize pos = 0, text = 0, reused = 0, start, end;
+	const char *nl;
+
+	/* spans with the same head are chained in file order */
+	for (k = n - 1; k >= 0; k--) {
+		next_same[k] = GPOINTER_TO_INT (g_hash_table_lookup (heads, &spans[k].head)) - 1;
+		g_hash_table_insert (heads, &spans[k].head, GINT_TO_POINTER (k + 1));
+	}
+	while (pos < len && i < n) {
+		cache_span_bounds (old, i, chdr->size, &start, &end);
+		if (end - start <= len - pos && cache_hash (data + pos, end - start) == spans[i].hash) {
+			add_piece (pieces, text, pos, -1);
+			add_piece (pieces, pos, pos + end - start, i);
+			reused += end - start;
+			pos = text = pos + end - start;
+			i++;
+			continue;
+		}
+		/* the old entries before a later span found here were dropped */
+		if (len - pos >= SPAN_HEAD) {
+			guint64 head = cache_hash (data + pos, SPAN_HEAD);
+
+			k = GPOINTER_TO_INT (g_hash_table_lookup (heads, &head)) - 1;
+			for (; k >= 0; k = next_same[k]) {
+				if (k <= i)
+					continue;
+				cache_span_bounds (old, k, chdr->size, &start, &end);
+				if (end - start <= len - pos && cache_hash (data + pos, end - start) == spans[k].hash)
+					break;
+			}
+			if (k >= 0) {
+				i = k;
+				continue;
+			}
+		}
+		nl = memchr (data + pos, '\n', len - pos);
+		pos = nl != NULL ? nl + 1 - data : len;
+	}
+	add_piece (pieces, text, len, -1);
+	g_hash_table_destroy (heads);
+	g_free (next_same);
+	if (reused < len / 2) {
+		g_array_free (pieces, TRUE);
+		return NULL;
+	}
+	return pieces;
+}
+
+/* Reads the new version of a file, data, using the entries of old where
+ * their text has not changed, and parsing only the rest. Gives up, returning
+ * NULL, if the changed parts don't parse on their own, like
+ * po_read_parallel() does with its chunks. Frees old either way. */
+static PoFile *
+cache_update (PoFile *old, const char *data, gsize len)
+{
+	PoCacheHeader *chdr = (PoCacheHeader *) old->buffer->data;
+	GArray *pieces = cache_match (old, data, len);
+	gboolean ok = TRUE, seen_obsolete = FALSE;
+	PoFile *pof;
+	int i, line = 1;
+
+	if (pieces == NULL) {
+		po_free (old);
+		return NULL;
+	}
+	pof = g_new (PoFile, 1);
+	pof->arena = po_arena_new ();
+	pof->buffer = NULL;
+	pof->adopted_buffers = NULL;
+	pof->entries = g_array_new (FALSE, FALSE, sizeof (PoEntry));
+	pof->obsolete_entries = g_array_new (FALSE, FALSE, sizeof (PoEntry));
+	for (i = 0; ok && i < pieces->len; i++) {
+		PoCachePiece *p = &g_array_index (pieces, PoCachePiece, i);
+
+		if (p->span >= 0) {
+			PoEntry po = *cache_nth_entry (old, p->span);
+			gsize start, end;
+
+			cache_span_bounds (old, p->span, chdr->size, &start, &end);
+			po.line += line - (p->span == 0 ? 1 : po.line);
+			po.offset += p->start - start;
+			if (po.flags & PO_OBSOLETE) {
+				g_array_append_val (pof->obsolete_entries, po);
+				seen_obsolete = TRUE;
+			} else {
+				g_array_append_val (pof->entries, po);
+				ok = !seen_obsolete;
+			}
+		} else if (!is_blank (data + p->start, p->end - p->start)) {
+			PoBuffer *buf = po_buffer_new (p->end - p->start);
+			guint n_entries = pof->entries->len;
+			guint n_obsolete = pof->obsolete_entries->len;
+
+			memcpy (buf->data, data + p->start, buf->len);
+			pof->adopted_buffers = g_slist_prepend (pof->adopted_buffers, buf);
+			ok = po_parse_part (pof, buf, p->start, line, NULL) &&
+			     !(seen_obsolete && pof->entries->len > n_entries);
+			if (pof->obsolete_entries->len > n_obsolete)
+				seen_obsolete = TRUE;
+		}
+		line += count_lines (data + p->start, p->end - p->start);
+	}
+	g_array_free (pieces, TRUE);
+	/* a po file has to start with a normal entry */
+	if (!ok || pof->entries->len == 0) {
+		po_free (pof);
+		po_free (old);
+		return NULL;
+	}
+	/* the entries which were kept point into the old cache */
+	pof->buffer = old->buffer;
+	old->buffer = NULL;
+	po_free (old);
+	return pof;
+}
+
+/* When the file has changed since it was cached, only the changed parts
+ * are parsed again, see cache_update(). */
+PoFile *
+po_read_cached (const char *fn, const char *cache_dir, int n_threads, PoFilters filters, GError **error)
+{
+	PoCacheHeader hdr, after;
+	gboolean stale = FALSE;
+	PoBuffer *src;
+	char *cache_fn;
+	PoFile *pof;
+
+	if ((src = cache_map_source (fn, &hdr)) == NULL)
+		return po_read_parallel (fn, n_threads, filters, error);
+	if ((cache_fn = cache_file_name (fn, cache_dir)) == NULL) {
+		po_buffer_free (src);
+		return po_read_parallel (fn, n_threads, filters, error);
+	}
+	if ((pof = cache_read (&hdr, cache_fn, &stale)) == NULL || stale) {
+		if (pof != NULL)
+			pof = cache_update (pof, src->data, src->len);
+		po_buffer_free (src);
+		/* everything is kept, for whatever filters come next */
+		if (pof == NULL && (pof = po_read_parallel (fn, n_threads, 0, error)) == NULL) {
+			g_free (cache_fn);
+			return NULL;
+		}
+		/* unless the file was changed while it was being read */
+		if ((src = cache_map_source (fn, &after)) != NULL) {
+			if (memcmp (&hdr, &after, sizeof hdr) == 0)
+				cache_write (pof, &hdr, src->data, cache_fn, cache_dir);
+			po_buffer_free (src);
+		}
+	} else {
+		po_buffer_free (src);
+	}
+	g_free (cache_fn);
+	po_apply_filters (pof, filters);
+	return pof;
+}
+
+/* --- single entries --- */
+
+static PoFile *
+cache_new_file (void)
+{
+	PoFile *pof = g_new (PoFile, 1);
+
+	pof->arena = po_arena_new ();
+	pof->buffer = NULL;
+	pof->adopted_buffers = NULL;
+	pof->entries = g_array_new (FALSE, FALSE, sizeof (PoEntry));
+	pof->obsolete_entries = g_array_new (FALSE, FALSE, sizeof (PoEntry));
+	return pof;
+}
+
+/* Maps the cache of fn as it is, without fixing it up, if it was written
+ * for a file of the same size and modification time as fn. Only the parts
+ * which are used are checked, not the whole file. */
+static PoCacheHeader *
+cache_map_index (const char *fn, const char *cache_dir, gsize *map_len)
+{
+	PoCacheHeader *chdr;
+	struct stat st, cst;
+	char *cache_fn, *base;
+	int fd;
+
+	if (strcmp (fn, "-") == 0 || stat (fn, &st) != 0 ||
+	    (cache_fn = cache_file_name (fn, cache_dir)) == NULL)
+		return NULL;
+	fd = open (cache_fn, O_RDONLY);
+	g_free (cache_fn);
+	if (fd < 0)
+		return NULL;
+	if (fstat (fd, &cst) != 0 || cst.st_size < sizeof (PoCacheHeader)) {
+		close (fd);
+		return NULL;
+	}
+	base = mmap (NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (base == MAP_FAILED)
+		return NULL;
+	/* only the parts looked at are read, so nothing is counted here, but
+	 * the entry's own text is, by cache_read_span() */
+	chdr = (PoCacheHeader *) base;
+	if (memcmp (chdr->magic, PO_CACHE_MAGIC, sizeof chdr->magic) != 0 ||
+	    chdr->version != PO_CACHE_VERSION || chdr->abi != cache_abi () ||
+	    !cache_header_ok (chdr, cst.st_size) ||
+	    !cache_range_ok (chdr, chdr->entries, chdr->n_entries, sizeof (PoEntry)) ||
+	    !cache_range_ok (chdr, chdr->obsolete_entries, chdr->n_obsolete_entries, sizeof (PoEntry)) ||
+	    chdr->dev != st.st_dev || chdr->ino != st.st_ino || chdr->size != st.st_size ||
+	    chdr->mtime_sec != st.st_mtim.tv_sec || chdr->mtime_nsec != st.st_mtim.tv_nsec) {
+		munmap (base, cst.st_size);
+		return NULL;
+	}
+	*map_len = cst.st_size;
+	return chdr;
+}
+
+/* The pointers of the entry are still offsets here. */
+static PoEntry *
+cache_index_entry (PoCacheHeader *chdr, int i)
+{
+	if (i < chdr->n_entries)
+		return (PoEntry *) ((char *) chdr + chdr->entries) + i;
+	return (PoEntry *) ((char *) chdr + chdr->obsolete_entries) + i - chdr->n_entries;
+}
+
+/* NULL if the block or its string are not within the file. */
+static const char *
+cache_index_str (PoCacheHeader *chdr, StringBlock *block)
+{
+	if (!cache_range_ok (chdr, PTR_OFFSET (block), 1, sizeof *block))
+		return NULL;
+	block = (StringBlock *) ((char *) chdr + PTR_OFFSET (block));
+	if (PTR_OFFSET (block->str) >= chdr->len - chdr->strings)
+		return NULL;
+	return (char *) chdr + chdr->strings + PTR_OFFSET (block->str);
+}
+
+/* The file order index of the nth entry, or the last non-obsolete one
+ * with the given msgctxt and msgid when id is not NULL, or -1, or -2 if
+ * the cache is damaged. */
+static int
+cache_index_find (PoCacheHeader *chdr, int nth, StringBlock *ctx, StringBlock *id)
+{
+	guint hash;
+	int i;
+
+	if (id == NULL)
+		return nth < chdr->n_entries + chdr->n_obsolete_entries ? nth : -1;
+	hash = po_entry_hash (ctx, id);
+	for (i = chdr->n_entries - 1; i >= 0; i--) {
+		PoEntry *po = cache_index_entry (chdr, i);
+		const char *s;
+
+		if (po->hash != hash || (po->ctx == NULL) != (ctx == NULL))
+			continue;
+		if (ctx != NULL) {
+			if ((s = cache_index_str (chdr, po->ctx)) == NULL)
+				return -2;
+			if (strcmp (s, ctx->str) != 0)
+				continue;
+		}
+		if ((s = cache_index_str (chdr, po->id)) == NULL)
+			return -2;
+		if (strcmp (s, id->str) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* Reads and parses only the text of entry i. Returns NULL unless that
+ * gives the same entry which was cached. */
+static PoFile *
+cache_read_span (const char *fn, PoCacheHeader *chdr, int i)
+{
+	PoEntry *po = cache_index_entry (chdr, i);
+	GArray *table;
+	PoFile *pof;
+	PoBuffer *buf;
+	ssize_t ret;
+	int fd;
+
+	if (po->offset > chdr->size || po->length > chdr->size - po->offset ||
+	    (fd = open (fn, O_RDONLY)) < 0)
+		return NULL;
+	buf = po_buffer_new (po->length);
+	ret = pread (fd, buf->data, po->length, po->offset);
+	close (fd);
+	if (ret != po->length) {
+		po_buffer_free (buf);
+		return NULL;
+	}
+	po_count_read (ret);
+	pof = cache_new_file ();
+	pof->buffer = buf;
+	table = po->flags & PO_OBSOLETE ? pof->obsolete_entries : pof->entries;
+	if (!po_parse_part (pof, buf, po->offset, po->line, NULL) ||
+	    pof->entries->len + pof->obsolete_entries->len != 1 || table->len != 1 ||
+	    g_array_index (table, PoEntry, 0).hash != po->hash) {
+		po_free (pof);
+		return NULL;
+	}
+	return pof;
+}
+
+/* Drops all the entries of a whole file but the wanted one. */
+static void
+select_entry (PoFile *pof, int nth, StringBlock *ctx, StringBlock *id)
+{
+	GArray *table = pof->entries;
+	PoEntry po;
+	int i = -1;
+
+	if (id != NULL) {
+		PoIndex *index = po_index_new (pof->entries);
+		PoEntry key, *found;
+
+		key.ctx = ctx;
+		key.id = id;
+		key.hash = po_entry_hash (ctx, id);
+		if ((found = po_index_lookup (index, &key)) != NULL)
+			i = found - (PoEntry *) pof->entries->data;
+		po_index_free (index);
+	} else if (nth < (int) pof->entries->len) {
+		i = nth;
+	} else if (nth - (int) pof->entries->len < (int) pof->obsolete_entries->len) {
+		table = pof->obsolete_entries;
+		i = nth - pof->entries->len;
+	}
+	if (i >= 0)
+		po = g_array_index (table, PoEntry, i);
+	g_array_set_size (pof->entries, 0);
+	g_array_set_size (pof->obsolete_entries, 0);
+	if (i >= 0)
+		g_array_append_val (table, po);
+}
+
+/* The cache is trusted as long as the file's size and modification time
+ * match it, and what is read of it is within it, which is all that is
+ * checked before reading the entry. The entry read must still be the one
+ * expected, though. Anything else goes
+ * through po_read_cached(), which brings the cache up to date. */
+static PoFile *
+read_entry (const char *fn, const char *cache_dir, int n_threads, int nth, StringBlock *ctx, StringBlock *id, GError **error)
+{
+	PoCacheHeader *chdr = NULL;
+	PoFile *pof = NULL;
+	gsize map_len;
+	int i;
+
+	if (cache_dir != NULL && (chdr = cache_map_index (fn, cache_dir, &map_len)) != NULL) {
+		i = cache_index_find (chdr, nth, ctx, id);
+		if (i >= 0) {
+			pof = cache_read_span (fn, chdr, i);
+		} else if (i == -1) {
+			pof = cache_new_file ();
+		}
+		munmap (chdr, map_len);
+	}
+	if (pof == NULL) {
+		if (cache_dir != NULL) {
+			pof = po_read_cached (fn, cache_dir, n_threads, 0, error);
+		} else {
+			pof = po_read_parallel (fn, n_threads, 0, error);
+		}
+		if (pof != NULL)
+			select_entry (pof, nth, ctx, id);
+	}
+	return pof;
+}
+
+PoFile *
+po_read_entry (const char *fn, const char *cache_dir, int n_threads, int n, GError **error)
+{
+	return read_entry (fn, cache_dir, n_threads, n, NULL, NULL, error);
+}
+
+PoFile *
+po_read_entry_id (const char *fn, const char *cache_dir, int n_threads, const char *ctx, const char *id, GError **error)
+{
+	StringBlock ctx_block = { (char *) ctx, 1, NULL };
+	StringBlock id_block = { (char *) id, 1, NULL };
+
+	return read_entry (fn, cache_dir, n_threads, -1, ctx != NULL ? &ctx_block : NULL, &id_block, error);
+}
@@ -0,0 +1,335 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "libpotool.h"
+#include "i18n.h"
+
+/* The syntax of po files is ASCII, so only charsets which leave ASCII alone
+ * are of any use. Most strings, and all the msgids of many files, are plain
+ * ASCII, so they need not be converted at all. */
+struct _PoRecoder {
+	GIConv cd;      /* (GIConv) -1 if there is nothing to convert */
+	char *to;
+	GString *buf;
+};
+
+PoEntry *
+po_file_header (PoFile *pof)
+{
+	PoEntry *po = (PoEntry *) pof->entries->data, *end = po + pof->entries->len;
+
+	for (; po < end; po++) {
+		if (po->flags & PO_HEADER)
+			return po;
+	}
+	return NULL;
+}
+
+/* Finds the value of the charset attribute in the header's msgstr, and
+ * returns its offset, or -1. */
+static int
+find_charset (PoEntry *header, int *len)
+{
+	const char *s, *v;
+
+	if (header->str == NULL)
+		return -1;
+	for (s = header->str->str; *s != '\0'; s++) {
+		if (g_ascii_strncasecmp (s, "charset=", 8) == 0)
+			break;
+	}
+	if (*s == '\0')
+		return -1;
+	s += 8;
+	for (v = s; *v != '\0' && strchr (" ;\\\"", *v) == NULL; v++)
+		;
+	if (v == s)
+		return -1;
+	*len = v - s;
+	return s - header->str->str;
+}
+
+char *
+po_entry_charset (PoEntry *header)
+{
+	int offset, len;
+
+	if ((offset = find_charset (header, &len)) < 0)
+		return NULL;
+	return g_strndup (header->str->str + offset, len);
+}
+
+/* Replaces the charset value, keeping the line lengths of the msgstr in
+ * step. */
+static void
+set_charset (PoArena *arena, PoEntry *header, const char *charset)
+{
+	StringBlock *old = header->str, *new;
+	int offset, len, charset_len = strlen (charset), i, line_end;
+
+	if ((offset = find_charset (header, &len)) < 0)
+		return;
+	new = po_arena_new_struct (arena, StringBlock, 1);
+	new->num_lines = old->num_lines;
+	new->line_lengths = po_arena_new_struct (arena, int, old->num_lines);
+	memcpy (new->line_lengths, old->line_lengths, old->num_lines * sizeof (int));
+	for (i = 0, line_end = 0; i < old->num_lines; i++) {
+		line_end += old->line_lengths[i];
+		if (offset < line_end) {
+			new->line_lengths[i] += charset_len - len;
+			break;
+		}
+	}
+	new->str = po_arena_alloc (arena, strlen (old->str) - len + charset_len + 1);
+	memcpy (new->str, old->str, offset);
+	strcpy (new->str + offset, charset);
+	strcpy (new->str + offset + charset_len, old->str + offset + len);
+	header->str = new;
+}
+
+static gboolean
+is_ascii (const char *s, gsize len)
+{
+	const char *end = s + len;
+#ifdef __SSE2__
+	__m128i bits = _mm_setzero_si128 ();
+
+	for (; end - s >= 16; s += 16) {
+		bits = _mm_or_si128 (bits, _mm_loadu_si128 ((const __m128i *) s));
+	}
+	if (_mm_movemask_epi8 (bits) != 0)
+		return FALSE;
+#endif
+	for (; s < end; s++) {
+		if ((guchar) *s >= 0x80)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* Appends s converted to rc->buf. Every string starts in the initial
+ * shift state. */
+static gboolean
+recode_append (PoRecoder *rc, const char *s, gsize len, GError **error)
+{
+	GString *buf = rc->buf;
+	gchar *in = (gchar *) s;
+	gsize in_left = len;
+	gboolean flushed = FALSE;
+
+	while (!flushed) {
+		gsize start = buf->len, out_left;
+		gchar *out;
+		gsize ret;
+
+		g_string_set_size (buf, start + in_left * 2 + 16);
+		out = buf->str + start;
+		out_left = buf->len - start;
+		if (in_left > 0) {
+			ret = g_iconv (rc->cd, &in, &in_left, &out, &out_left);
+		} else {
+			ret = g_iconv (rc->cd, NULL, NULL, &out, &out_left);
+			flushed = ret != (gsize) -1;
+		}
+		g_string_truncate (buf, out - buf->str);
+		if (ret != (gsize) -1 || errno == E2BIG)
+			continue;
+		if (errno == EILSEQ) {
+			g_set_error (error, PO_ERROR, PO_ERROR_CHARSET,
+			             _("Can't convert \"%.*s\" to %s"), (int) len, s, rc->to);
+		} else if (errno == EINVAL) {
+			g_set_error (error, PO_ERROR, PO_ERROR_CHARSET,
+			             _("Incomplete character at the end of \"%.*s\""), (int) len, s);
+		} else {
+			g_set_error (error, PO_ERROR, PO_ERROR_CHARSET,
+			             _("Can't convert to %s: %s"), rc->to, g_strerror (errno));
+		}
+		g_iconv (rc->cd, NULL, NULL, NULL, NULL);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+PoRecoder *
+po_recoder_new (const char *from, const char *to, GError **error)
+{
+	PoRecoder *rc = g_new (PoRecoder, 1);
+
+	rc->cd = (GIConv) -1;
+	rc->to = g_strdup (to);
+	rc->buf = g_string_sized_new (256);
+	if (g_ascii_strcasecmp (from, to) != 0) {
+		char ascii[128];
+		int i;
+
+		rc->cd = g_iconv_open (to, from);
+		if (rc->cd == (GIConv) -1) {
+			g_set_error (error, PO_ERROR, PO_ERROR_CHARSET,
+			             _("Can't convert from %s to %s"), from, to);
+			po_recoder_free (rc);
+			return NULL;
+		}
+		/* not the case for UTF-16 or UTF-7, for example */
+		for (i = 1; i < 128; i++) {
+			ascii[i - 1] = i;
+		}
+		if (!recode_append (rc, ascii, 127, NULL) ||
+		    rc->buf->len != 127 || memcmp (rc->buf->str, ascii, 127) != 0) {
+			g_set_error (error, PO_ERROR, PO_ERROR_CHARSET,
+			             _("Can't convert from %s to %s, as they differ in ASCII"), from, to);
+			po_recoder_free (rc);
+			return NULL;
+		}
+	}
+	return rc;
+}
+
+void
+po_recoder_free (PoRecoder *rc)
+{
+	if (rc->cd != (GIConv) -1)
+		g_iconv_close (rc->cd);
+	g_string_free (rc->buf, TRUE);
+	g_free (rc->to);
+	g_free (rc);
+}
+
+/* Lines are converted one by one, so that their lengths are known for -p. */
+static gboolean
+recode_block (PoRecoder *rc, PoArena *arena, StringBlock **block, GError **error)
+{
+	StringBlock *old = *block, *new;
+	const char *s;
+	gsize len = 0;
+	int i;
+
+	if (old == NULL)
+		return TRUE;
+	for (i = 0; i < old->num_lines; i++) {
+		len += old->line_lengths[i];
+	}
+	if (is_ascii (old->str, len))
+		return TRUE;
+	new = po_arena_new_struct (arena, StringBlock, 1);
+	new->num_lines = old->num_lines;
+	new->line_lengths = po_arena_new_struct (arena, int, old->num_lines);
+	g_string_truncate (rc->buf, 0);
+	for (i = 0, s = old->str; i < old->num_lines; s += old->line_lengths[i++]) {
+		gsize start = rc->buf->len;
+
+		if (is_ascii (s, old->line_lengths[i])) {
+			g_string_append_len (rc->buf, s, old->line_lengths[i]);
+		} else if (!recode_append (rc, s, old->line_lengths[i], error)) {
+			return FALSE;
+		}
+		new->line_lengths[i] = rc->buf->len - start;
+	}
+	new->str = po_arena_strndup (arena, rc->buf->str, rc->buf->len);
+	*block = new;
+	return TRUE;
+}
+
+static gboolean
+recode_lines (PoRecoder *rc, PoArena *arena, PoLines *lines, GError **error)
+{
+	char **new = NULL;
+	int i;
+
+	for (i = 0; i < lines->n; i++) {
+		const char *s = lines->lines[i];
+		gsize len = strlen (s);
+
+		if (is_ascii (s, len))
+			continue;
+		if (new == NULL) {
+			new = po_arena_new_struct (arena, char *, lines->n);
+			memcpy (new, lines->lines, lines->n * sizeof (char *));
+		}
+		g_string_truncate (rc->buf, 0);
+		if (!recode_append (rc, s, len, error))
+			return FALSE;
+		new[i] = po_arena_strndup (arena, rc->buf->str, rc->buf->len);
+	}
+	if (new != NULL)
+		lines->lines = new;
+	return TRUE;
+}
+
+gboolean
+po_recode_entry (PoRecoder *rc, PoArena *arena, PoEntry *po, GError **error)
+{
+	int i;
+
+	if (rc->cd != (GIConv) -1) {
+		StringBlock *ctx = po->ctx, *id = po->id;
+		MsgStrX *msgstrxs = po->msgstrxs;
+
+		if (!recode_lines (rc, arena, &po->comments.std, error) ||
+		    !recode_lines (rc, arena, &po->comments.pos, error) ||
+		    !recode_lines (rc, arena, &po->comments.res, error) ||
+		    !recode_lines (rc, arena, &po->comments.spec, error) ||
+		    !recode_block (rc, arena, &po->previous.ctx, error) ||
+		    !recode_block (rc, arena, &po->previous.id, error) ||
+		    !recode_block (rc, arena, &po->previous.id_plural, error) ||
+		    !recode_block (rc, arena, &po->ctx, error) ||
+		    !recode_block (rc, arena, &po->id, error) ||
+		    !recode_block (rc, arena, &po->id_plural, error) ||
+		    !recode_block (rc, arena, &po->str, error))
+			return FALSE;
+		for (i = 0; i < po->n_msgstrxs; i++) {
+			StringBlock *str = po->msgstrxs[i].str;
+
+			if (!recode_block (rc, arena, &str, error))
+				return FALSE;
+			if (str == po->msgstrxs[i].str)
+				continue;
+			if (msgstrxs == po->msgstrxs) {
+				msgstrxs = po_arena_new_struct (arena, MsgStrX, po->n_msgstrxs);
+				memcpy (msgstrxs, po->msgstrxs, po->n_msgstrxs * sizeof (MsgStrX));
+			}
+			msgstrxs[i].str = str;
+		}
+		po->msgstrxs = msgstrxs;
+		if (po->ctx != ctx || po->id != id)
+			po->hash = po_entry_hash (po->ctx, po->id);
+	}
+	if ((po->flags & PO_HEADER) && !(po->flags & PO_OBSOLETE))
+		set_charset (arena, po, rc->to);
+	return TRUE;
+}
+
+gboolean
+po_recode_file (PoFile *pof, const char *to, GError **error)
+{
+	PoEntry *header = po_file_header (pof), *po, *end;
+	PoRecoder *rc;
+	char *from;
+	gboolean ok = TRUE;
+
+	if (header == NULL || (from = po_entry_charset (header)) == NULL) {
+		g_set_error (error, PO_ERROR, PO_ERROR_CHARSET,
+		             _("No charset in the header entry"));
+		return FALSE;
+	}
+	rc = po_recoder_new (from, to, error);
+	g_free (from);
+	if (rc == NULL)
+		return FALSE;
+	for (po = (PoEntry *) pof->entries->data, end = po + pof->entries->len; ok && po < end; po++) {
+		ok = po_recode_entry (rc, pof->arena, po, error);
+	}
+	for (po = (PoEntry *) pof->obsolete_entries->data, end = po + pof->obsolete_entries->len; ok && po < end; po++) {
+		ok = po_recode_entry (rc, pof->arena, po, error);
+	}
+	po_recoder_free (rc);
+	return ok;
+}
@@ -0,0 +1,63 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#include <glib.h>
+#include "po-gram.h"
+
+/* Everything is counted locally, by the parser, the arenas and the writers,
+ * and added here in bulk, so the lock is not taken often. */
+static gboolean counting;
+static PoCounters totals;
+static GMutex totals_lock;
+
+void
+po_counters_enable (void)
+{
+	counting = TRUE;
+}
+
+void
+po_counters_get (PoCounters *counters)
+{
+	g_mutex_lock (&totals_lock);
+	*counters = totals;
+	g_mutex_unlock (&totals_lock);
+}
+
+void
+po_counters_add (const PoCounters *delta)
+{
+	if (!counting)
+		return;
+	g_mutex_lock (&totals_lock);
+	totals.bytes_read += delta->bytes_read;
+	totals.bytes_written += delta->bytes_written;
+	totals.tokens += delta->tokens;
+	totals.entries_parsed += delta->entries_parsed;
+	totals.entries_kept += delta->entries_kept;
+	totals.allocs += delta->allocs;
+	totals.alloc_bytes += delta->alloc_bytes;
+	totals.alloc_chunks += delta->alloc_chunks;
+	g_mutex_unlock (&totals_lock);
+}
+
+void
+po_count_read (gsize len)
+{
+	PoCounters delta = { 0 };
+
+	delta.bytes_read = len;
+	po_counters_add (&delta);
+}
+
+void
+po_count_written (gsize len)
+{
+	PoCounters delta = { 0 };
+
+	delta.bytes_written = len;
+	po_counters_add (&delta);
+}
@@ -0,0 +1,649 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 1999-2002 Zbigniew Chyla
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <glib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "po-gram.h"
+
+#define RMARGIN 80
+
+GQuark
+po_error_quark (void)
+{
+	return g_quark_from_static_string ("potool-error-quark");
+}
+
+StringBlock*
+stringblock_dup(PoArena *arena, StringBlock *block)
+{
+	if (block == NULL)
+		return NULL;
+	StringBlock *ret = po_arena_new_struct (arena, StringBlock, 1);
+	*ret = *block;
+	ret->str = po_arena_strdup (arena, ret->str);
+	ret->line_lengths = po_arena_new_struct (arena, int, ret->num_lines);
+	memcpy(ret->line_lengths, block->line_lengths, sizeof(int) * ret->num_lines);
+	return ret;
+}
+
+PoLines
+po_lines_dup(PoArena *arena, PoLines lines)
+{
+	PoLines ret;
+	int i;
+
+	ret.n = lines.n;
+	ret.lines = po_arena_new_struct (arena, char *, lines.n);
+	for (i = 0; i < lines.n; i++) {
+		ret.lines[i] = po_arena_strdup (arena, lines.lines[i]);
+	}
+	return ret;
+}
+
+MsgStrX *
+po_msgstrxs_dup(PoArena *arena, MsgStrX *msgstrxs, int n)
+{
+	MsgStrX *ret = po_arena_new_struct (arena, MsgStrX, n);
+	int i;
+
+	for (i = 0; i < n; i++) {
+		ret[i].n = msgstrxs[i].n;
+		ret[i].str = stringblock_dup(arena, msgstrxs[i].str);
+	}
+	return ret;
+}
+
+/* Makes a deep copy of po, allocated from arena. */
+PoEntry *
+po_entry_copy (PoArena *arena, PoEntry *ret, PoEntry *po)
+{
+	if (ret == NULL)
+		ret = po_arena_new_struct (arena, PoEntry, 1);
+
+	ret->comments.std = po_lines_dup(arena, po->comments.std);
+	ret->comments.pos = po_lines_dup(arena, po->comments.pos);
+	ret->comments.res = po_lines_dup(arena, po->comments.res);
+	ret->comments.spec = po_lines_dup(arena, po->comments.spec);
+
+	ret->previous.ctx = stringblock_dup (arena, po->previous.ctx);
+	ret->previous.id = stringblock_dup (arena, po->previous.id);
+	ret->previous.id_plural = stringblock_dup (arena, po->previous.id_plural);
+
+	ret->flags = po->flags;
+
+	ret->ctx = stringblock_dup (arena, po->ctx);
+	ret->id = stringblock_dup (arena, po->id);
+	ret->id_plural = stringblock_dup (arena, po->id_plural);
+	ret->str = stringblock_dup (arena, po->str);
+
+	ret->msgstrxs = po_msgstrxs_dup(arena, po->msgstrxs, po->n_msgstrxs);
+	ret->n_msgstrxs = po->n_msgstrxs;
+	ret->hash = po->hash;
+	ret->offset = po->offset;
+	ret->length = po->length;
+	ret->line = po->line;
+
+	return ret;
+}
+
+void
+po_free (PoFile *pof)
+{
+	g_array_free (pof->entries, TRUE);
+	g_array_free (pof->obsolete_entries, TRUE);
+	po_arena_free (pof->arena);
+	po_buffer_free (pof->buffer);
+	g_slist_free_full (pof->adopted_buffers, (GDestroyNotify) po_buffer_free);
+	g_free (pof);
+}
+
+void
+po_adopt (PoFile *pof, PoFile *other)
+{
+	po_arena_adopt (pof->arena, other->arena);
+	pof->adopted_buffers = g_slist_prepend (pof->adopted_buffers, other->buffer);
+	pof->adopted_buffers = g_slist_concat (other->adopted_buffers, pof->adopted_buffers);
+	g_array_free (other->entries, TRUE);
+	g_array_free (other->obsolete_entries, TRUE);
+	g_free (other);
+}
+
+/* Moves entries which were found at a different place in the file. */
+void
+po_entries_shift (GArray *table, gssize offset, int lines)
+{
+	int i;
+
+	for (i = 0; i < table->len; i++) {
+		PoEntry *po = &g_array_index (table, PoEntry, i);
+
+		po->offset += offset;
+		po->line += lines;
+	}
+}
+
+/* --- PoEntry filters --- */
+
+/* Returns TRUE if po passes all the filters. */
+gboolean
+po_entry_filter (PoEntry *po, PoFilters filters)
+{
+	PoEntryFlags flags = po->flags;
+
+	if ((filters & OBSOLETE_FILTER) != 0 && !(flags & PO_OBSOLETE))
+		return FALSE;
+	if ((filters & NOT_OBSOLETE_FILTER) != 0 && (flags & PO_OBSOLETE))
+		return FALSE;
+	if ((filters & FUZZY_FILTER) != 0 && !(flags & PO_FUZZY))
+		return FALSE;
+	if ((filters & NOT_FUZZY_FILTER) != 0 && (flags & PO_FUZZY))
+		return FALSE;
+	if ((filters & TRANSLATED_FILTER) != 0 && !(flags & PO_TRANSLATED))
+		return FALSE;
+	/* with plural forms, any untranslated one counts */
+	if ((filters & NOT_TRANSLATED_FILTER) != 0 && (flags & PO_TRANSLATED))
+		return FALSE;
+	if ((filters & NOT_TRANSLATED_H_FILTER) != 0 && (flags & PO_TRANSLATED) && !(flags & PO_HEADER))
+		return FALSE;
+	return TRUE;
+}
+
+/* Removes entries rejected by the filters, keeping the order of the rest. */
+static void
+po_table_filter (GArray *table, PoFilters filters)
+{
+	PoEntry *po = (PoEntry *) table->data, *end = po + table->len;
+	PoEntry *kept = po;
+
+	for (; po < end; po++) {
+		if (po_entry_filter (po, filters)) {
+			if (kept != po)
+				*kept = *po;
+			kept++;
+		}
+	}
+	g_array_set_size (table, kept - (PoEntry *) table->data);
+}
+
+void
+po_apply_filters (PoFile *pof, PoFilters filters)
+{
+	if (filters == 0)
+		return;
+	po_table_filter (pof->entries, filters);
+	po_table_filter (pof->obsolete_entries, filters);
+}
+
+
+/* --- */
+
+enum {
+	SEP1 = ' ',
+	SEP2 = '\t'
+};
+
+
+#define PO_WRITER_BUF_SIZE (128 * 1024)
+
+/* Blocks handed over to the writer thread. There are only two, one being
+ * filled while the other is written. */
+typedef struct {
+	char *data;
+	gsize len;
+} PoOutBlock;
+
+struct _PoWriterThread {
+	GThread *thread;
+	GAsyncQueue *full, *empty;
+	PoOutBlock blocks[2];
+	PoOutBlock *cur;
+	FILE *out;
+	volatile gint error;
+};
+
+/* errno is only set by a failing write, not by every short fwrite(), so
+ * whatever an earlier call left there must not be taken for the cause. */
+static int
+write_block (FILE *out, const char *s, gsize len)
+{
+	errno = 0;
+	if (len > 0 && fwrite (s, 1, len, out) != len)
+		return errno != 0 ? errno : EIO;
+	return 0;
+}
+
+void
+po_writer_init (PoWriter *pw, FILE *out, po_write_modes mode, gboolean preserve_wrapping)
+{
+	pw->out = out;
+	pw->mode = mode;
+	pw->preserve_wrapping = preserve_wrapping;
+	pw->wrote_entry = FALSE;
+	pw->error = 0;
+	pw->buf = g_malloc (PO_WRITER_BUF_SIZE);
+	pw->buf_len = 0;
+	pw->thread = NULL;
+}
+
+static gpointer
+po_writer_thread (gpointer data)
+{
+	PoWriterThread *wt = data;
+	PoOutBlock *block;
+
+	/* the thread itself marks the end */
+	while ((block = g_async_queue_pop (wt->full)) != (gpointer) wt) {
+		if (g_atomic_int_get (&wt->error) == 0) {
+			int error = write_block (wt->out, block->data, block->len);
+			if (error != 0)
+				g_atomic_int_set (&wt->error, error);
+		}
+		g_async_queue_push (wt->empty, block);
+	}
+	return NULL;
+}
+
+void
+po_writer_start_thread (PoWriter *pw)
+{
+	PoWriterThread *wt = g_new (PoWriterThread, 1);
+
+	wt->full = g_async_queue_new ();
+	wt->empty = g_async_queue_new ();
+	wt->blocks[0].data = pw->buf;
+	wt->blocks[1].data = g_malloc (PO_WRITER_BUF_SIZE);
+	wt->cur = &wt->blocks[0];
+	g_async_queue_push (wt->empty, &wt->blocks[1]);
+	wt->out = pw->out;
+	wt->error = 0;
+	wt->thread = g_thread_new ("po-writer", po_writer_thread, wt);
+	pw->thread = wt;
+}
+
+static void
+po_writer_flush (PoWriter *pw)
+{
+	PoWriterThread *wt = pw->thread;
+
+	po_count_written (pw->buf_len);
+	if (wt == NULL) {
+		if (pw->error == 0)
+			pw->error = write_block (pw->out, pw->buf, pw->buf_len);
+	} else {
+		wt->cur->len = pw->buf_len;
+		g_async_queue_push (wt->full, wt->cur);
+		wt->cur = g_async_queue_pop (wt->empty);
+		pw->buf = wt->cur->data;
+		if (pw->error == 0)
+			pw->error = g_atomic_int_get (&wt->error);
+	}
+	pw->buf_len = 0;
+}
+
+void
+po_writer_finish (PoWriter *pw)
+{
+	PoWriterThread *wt = pw->thread;
+
+	po_writer_flush (pw);
+	if (wt != NULL) {
+		g_async_queue_push (wt->full, wt);
+		g_thread_join (wt->thread);
+		if (pw->error == 0)
+			pw->error = wt->error;
+		g_free (wt->blocks[0].data);
+		g_free (wt->blocks[1].data);
+		g_async_queue_unref (wt->full);
+		g_async_queue_unref (wt->empty);
+		g_free (wt);
+		pw->thread = NULL;
+	} else {
+		g_free (pw->buf);
+	}
+	pw->buf = NULL;
+	errno = 0;
+	if (fflush (pw->out) != 0 && pw->error == 0)
+		pw->error = errno != 0 ? errno : EIO;
+}
+
+static void
+po_write_bytes (PoWriter *pw, const char *s, gsize len)
+{
+	if (pw->error != 0)
+		return;
+	while (len > PO_WRITER_BUF_SIZE - pw->buf_len) {
+		gsize n = PO_WRITER_BUF_SIZE - pw->buf_len;
+
+		memcpy (pw->buf + pw->buf_len, s, n);
+		pw->buf_len += n;
+		s += n;
+		len -= n;
+		po_writer_flush (pw);
+	}
+	memcpy (pw->buf + pw->buf_len, s, len);
+	pw->buf_len += len;
+}
+
+#define po_write_literal(pw, s) po_write_bytes ((pw), (s), sizeof (s) - 1)
+
+static void
+po_write_str (PoWriter *pw, const char *s)
+{
+	po_write_bytes (pw, s, strlen (s));
+}
+
+/* Writes mark, then s and a newline, as in comments. */
+static void
+po_write_line (PoWriter *pw, const char *mark, const char *s)
+{
+	po_write_str (pw, mark);
+	po_write_str (pw, s);
+	po_write_literal (pw, "\n");
+}
+
+/* Returns the first SEP1 or SEP2 in [s, end), or end. */
+static const char *
+find_sep (const char *s, const char *end)
+{
+#ifdef __SSE2__
+	const __m128i sep1 = _mm_set1_epi8 (SEP1), sep2 = _mm_set1_epi8 (SEP2);
+
+	for (; end - s >= 16; s += 16) {
+		__m128i v = _mm_loadu_si128 ((const __m128i *) s);
+		int mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, sep1),
+		                                            _mm_cmpeq_epi8 (v, sep2)));
+		if (mask != 0)
+			return s + g_bit_nth_lsf (mask, -1);
+	}
+#endif
+	for (; s < end; s++) {
+		if (*s == SEP1 || *s == SEP2)
+			break;
+	}
+	return s;
+}
+
+/* Returns the first escaped newline in [s, end), or end. Just like
+ * strstr (s, "\\n"), it also matches the end of "\\\\n". */
+static const char *
+find_eol (const char *s, const char *end)
+{
+	while ((s = memchr (s, '\\', end - s)) != NULL) {
+		if (s + 1 < end && s[1] == 'n')
+			return s;
+		s++;
+	}
+	return end;
+}
+
+/* Unless the wrapping is preserved, s is split after every escaped newline,
+ * and the resulting lines are wrapped at word boundaries to fit in the right
+ * margin. This works on s in place, without allocating anything. */
+static void
+print_multi_line (PoWriter *pw, const StringBlock *s, int start_offset, const char *prefix)
+{
+	int prefix_len;
+	gsize slen;
+	const char *end, *line, *line_end;
+	enum { max_len = 77 };
+
+	if (pw->preserve_wrapping) {
+		int i, offset = 0;
+		for (i = 0; i < s->num_lines; i++) {
+			int line_len = s->line_lengths[i];
+			if (i > 0) {
+				po_write_str (pw, prefix);
+			}
+			po_write_literal (pw, "\"");
+			po_write_bytes (pw, s->str + offset, line_len);
+			po_write_literal (pw, "\"\n");
+			offset += line_len;
+		}
+		return;
+	}
+
+	slen = strlen (s->str);
+	end = s->str + slen;
+	line_end = find_eol (s->str, end);
+	if ((line_end == end || line_end + 2 == end)
+	    && slen < (RMARGIN - 2 - start_offset)) {
+		po_write_literal (pw, "\"");
+		po_write_bytes (pw, s->str, slen);
+		po_write_literal (pw, "\"\n");
+		return;
+	}
+
+	po_write_literal (pw, "\"\"\n");
+	prefix_len = strlen (prefix);
+	for (line = s->str; ; line = line_end + 2, line_end = find_eol (line, end)) {
+		const char *cur, *run;
+		int offset;
+		gboolean line_has_eol = line_end != end;
+
+		/* nothing follows the final newline */
+		if (!line_has_eol && line == end)
+			break;
+		po_write_bytes (pw, prefix, prefix_len);
+		po_write_literal (pw, "\"");
+		offset = prefix_len;
+		cur = run = line;
+		do {
+			const char *word_end = find_sep (cur, line_end);
+			int word_len, eol_len;
+
+			while (word_end < line_end && (*word_end == SEP1 || *word_end == SEP2))
+				word_end++;
+			word_len = word_end - cur;
+
+			if (line_has_eol && word_end == line_end &&
+			    (word_len == 0 || (word_end[-1] != SEP1 && word_end[-1] != SEP2))) {
+				eol_len = 2;
+			} else {
+				eol_len = 0;
+			}
+			if (offset + word_len + eol_len > max_len) {
+				po_write_bytes (pw, run, cur - run);
+				po_write_literal (pw, "\"\n");
+				po_write_bytes (pw, prefix, prefix_len);
+				po_write_literal (pw, "\"");
+				offset = prefix_len;
+				run = cur;
+			}
+			offset += word_len;
+			cur = word_end;
+		} while (cur < line_end);
+		po_write_bytes (pw, run, cur - run);
+
+		if (line_has_eol) {
+			if (offset + 2 > max_len) {
+				po_write_literal (pw, "\"\n");
+				po_write_bytes (pw, prefix, prefix_len);
+				po_write_literal (pw, "\"\\n");
+			} else {
+				po_write_literal (pw, "\\n");
+			}
+		}
+		po_write_literal (pw, "\"\n");
+		if (!line_has_eol)
+			break;
+	}
+}
+
+static void
+write_msgstr (PoWriter *pw, char *prefix, StringBlock *str, MsgStrX *strn, int n_strn)
+{
+	int prefix_len = strlen(prefix);
+
+	if (!(pw->mode & NO_TRANSLATION)) {
+		if (str && str->str) {
+			po_write_bytes (pw, prefix, prefix_len);
+			po_write_literal (pw, "msgstr ");
+			print_multi_line (pw, str, 7 + prefix_len, prefix);
+		} else {
+			MsgStrX *m;
+			for (m = strn; m < strn + n_strn; m++) {
+				char tag[32];
+
+				po_write_bytes (pw, prefix, prefix_len);
+				po_write_bytes (pw, tag, g_snprintf (tag, sizeof tag, "msgstr[%d] ", m->n));
+				print_multi_line (pw, m->str, 10 + prefix_len, prefix);
+			}
+		}
+	} else {
+		po_write_bytes (pw, prefix, prefix_len);
+		po_write_literal (pw, "msgstr \"\"\n");
+	}
+}
+
+
+void
+po_write_entry (PoWriter *pw, PoEntry *po, gboolean is_obsolete)
+{
+	int i;
+
+	/* Entries are separated by empty lines, and so is the obsolete part
+	 * of the file, even when there are no other entries. */
+	if (is_obsolete || pw->wrote_entry) {
+		po_write_literal (pw, "\n");
+	}
+	if (!is_obsolete) {
+		if (!(pw->mode & NO_STD_COMMENT)) {
+			for (i = 0; i < po->comments.std.n; i++) {
+				po_write_line (pw, "#", po->comments.std.lines[i]);
+			}
+		}
+		if (!(pw->mode & NO_RES_COMMENT)) {
+			for (i = 0; i < po->comments.res.n; i++) {
+				po_write_line (pw, "#", po->comments.res.lines[i]);
+			}
+		}
+		if (!(pw->mode & NO_POS_COMMENT)) {
+			if (!(pw->mode & NO_LINF)) {
+				for (i = 0; i < po->comments.pos.n; i++) {
+					po_write_line (pw, "#:", po->comments.pos.lines[i]);
+				}
+			} else {
+				for (i = 0; i < po->comments.pos.n; i++) {
+					char *s = g_strdup (po->comments.pos.lines[i]);
+					char *l, *r;
+
+					l = r = s;
+					while (*r != '\0') {
+						if (*r == ':') {
+							*l++ = ':';
+							*l++ = '1';
+							while (isdigit (*++r))
+								;
+						} else {
+							*l++ = *r++;
+						}
+					}
+					*l = '\0';
+					po_write_line (pw, "#:", s);
+					g_free (s);
+				}
+			}
+		}
+		if (!(pw->mode & NO_SPEC_COMMENT)) {
+			for (i = 0; i < po->comments.spec.n; i++) {
+				po_write_line (pw, "#,", po->comments.spec.lines[i]);
+			}
+		}
+		if (!(pw->mode & NO_PREVIOUS)) {
+			if (po->previous.ctx) {
+				po_write_literal (pw, "#| msgctxt ");
+				print_multi_line (pw, po->previous.ctx, 11, "");
+			}
+			if (po->previous.id) {
+				po_write_literal (pw, "#| msgid ");
+				print_multi_line (pw, po->previous.id, 9, "");
+			}
+			if (po->previous.id_plural) {
+				po_write_literal (pw, "#| msgid_plural ");
+				print_multi_line (pw, po->previous.id_plural, 16, "");
+			}
+		}
+		if ((!(pw->mode & NO_CTX)) && po->ctx) {
+			po_write_literal (pw, "msgctxt ");
+			print_multi_line (pw, po->ctx, 8, "");
+		}
+		if (!(pw->mode & NO_ID)) {
+			po_write_literal (pw, "msgid ");
+			print_multi_line (pw, po->id, 6, "");
+			if (po->id_plural) {
+				po_write_literal (pw, "msgid_plural ");
+				print_multi_line (pw, po->id_plural, 13, "");
+			}
+		}
+		if (!(pw->mode & NO_STR)) {
+			write_msgstr (pw, "", po->str, po->msgstrxs, po->n_msgstrxs);
+		}
+		pw->wrote_entry = TRUE;
+	} else {
+		if (!(pw->mode & NO_STD_COMMENT)) {
+			for (i = 0; i < po->comments.std.n; i++) {
+				po_write_line (pw, "#", po->comments.std.lines[i]);
+			}
+		}
+		if (!(pw->mode & NO_SPEC_COMMENT)) {
+			for (i = 0; i < po->comments.spec.n; i++) {
+				po_write_line (pw, "#,", po->comments.spec.lines[i]);
+			}
+		}
+		if (!(pw->mode & NO_PREVIOUS)) {
+			if (po->previous.ctx) {
+				po_write_literal (pw, "#~| msgctxt ");
+				print_multi_line (pw, po->previous.ctx, 12, "");
+			}
+			if (po->previous.id) {
+				po_write_literal (pw, "#~| msgid ");
+				print_multi_line (pw, po->previous.id, 10, "");
+			}
+			if (po->previous.id_plural) {
+				po_write_literal (pw, "#~| msgid_plural ");
+				print_multi_line (pw, po->previous.id_plural, 17, "");
+			}
+		}
+
+		if ((!(pw->mode & NO_CTX)) && po->ctx) {
+			po_write_literal (pw, "#~ msgctxt ");
+			print_multi_line (pw, po->ctx, 11, "#~ ");
+		}
+
+		if (!(pw->mode & NO_ID)) {
+			po_write_literal (pw, "#~ msgid ");
+			print_multi_line (pw, po->id, 9, "#~ ");
+			if (po->id_plural) {
+				po_write_literal (pw, "#~ msgid_plural ");
+				print_multi_line (pw, po->id_plural, 16, "#~ ");
+			}
+		}
+		if (!(pw->mode & NO_STR)) {
+			write_msgstr (pw, "#~ ", po->str, po->msgstrxs, po->n_msgstrxs);
+		}
+	}
+}
+
+
+void
+po_write (PoWriter *pw, PoFile *pof)
+{
+	PoEntry *po, *end;
+
+	for (po = (PoEntry *) pof->entries->data, end = po + pof->entries->len; po < end; po++) {
+		po_write_entry (pw, po, FALSE);
+	}
+	for (po = (PoEntry *) pof->obsolete_entries->data, end = po + pof->obsolete_entries->len; po < end; po++) {
+		po_write_entry (pw, po, TRUE);
+	}
+}
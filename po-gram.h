@@ -8,46 +8,66 @@
 #ifndef PO_GRAM_H
 #define PO_GRAM_H
 
+#include <stdio.h>
 #include <glib.h>
+#include "libpotool.h"
 
-void po_scan_open_file(char *fn);
-void po_scan_close_file(void);
-void po_init_parser(void);
-
-/* ---- */
-
-typedef struct {
-	char *str;
-	int num_lines;
-	int *line_lengths;
-} StringBlock;
+/* A whole input file, either mapped or read into memory. It is followed by
+ * PO_BUFFER_PADDING NUL bytes, as required by yy_scan_buffer(). Parsed
+ * strings point into it whenever possible, so it must outlive them.
+ */
+#define PO_BUFFER_PADDING 2
 
-typedef struct {
-	GSList *std, *pos, *res;
-	GSList *spec;
-} PoComments;
+struct _PoBuffer {
+	char *data;
+	gsize len;
+	gsize map_len;  /* 0 if data was read into malloced memory */
+	gsize discarded;
+};
 
-typedef struct {
-	StringBlock *ctx, *id, *id_plural;
-} PoPrevious;
+int po_input_open (const char *fn, GError **error);
+PoBuffer *po_buffer_map (int fd);
+PoBuffer *po_buffer_read (const char *fn, GError **error);
+PoBuffer *po_buffer_new (gsize len);
+void po_buffer_discard (PoBuffer *buf, const char *upto);
+void po_buffer_free (PoBuffer *buf);
 
+/* State of a single parse, shared by the parser and the scanner. */
 typedef struct {
-	StringBlock *str;
-	int n;
-} MsgStrX;
+	PoArena *arena;         /* where the current entry goes */
+	PoArena *spare_arena;   /* only when streaming, see emit_entry() */
+	PoEntryFunc *entry_func;
+	gpointer entry_data;
+	PoFilters filters;      /* entries rejected by them are not emitted */
+	po_write_modes omit;    /* parts of entries nobody needs */
+	gboolean parsed_entry, parsed_obsolete;
+	PoBuffer *input;        /* NULL when reading from a stream */
+	void *scanner;
+	int start_token;        /* returned before the input, if not 0 */
+	/* where the next token starts in the whole file, which is not where
+	 * the input starts when parsing a part of it; line 0 means 1 */
+	gsize offset;
+	int line;
+	guint64 n_tokens;
+	int n_parsed, n_kept;   /* entries, before and after filtering */
+	GError *error;
+} PoParser;
 
-typedef struct {
-	PoComments comments;
-	PoPrevious previous;
-	gboolean is_fuzzy, is_c_format;
-	StringBlock *ctx, *id, *id_plural, *str;
-	GSList *msgstrxs;
-} PoEntry;
+/* The scanner is closed by po_parse(), or right away if opening fails. */
+gboolean po_scan_open_buffer (PoParser *parser, PoBuffer *buf, GError **error);
+gboolean po_scan_open_stream (PoParser *parser, FILE *f, GError **error);
+void po_scan_discard_consumed (PoParser *parser);
+int po_scan_lineno (PoParser *parser);
+void po_scan_close (PoParser *parser);
 
-typedef struct {
-	GSList *entries, *obsolete_entries;
-} PoFile;
+gboolean po_parse_part (PoFile *pof, PoBuffer *buf, gsize offset, int line, GError **error);
+void po_entries_shift (GArray *table, gssize offset, int lines);
+PoLines po_lines_dup (PoArena *arena, PoLines lines);
+MsgStrX *po_msgstrxs_dup (PoArena *arena, MsgStrX *msgstrxs, int n);
 
-PoFile *po_read (char *fn);
+/* Add to the totals of po_counters_get(), unless counting is off. */
+void po_counters_add (const PoCounters *delta);
+void po_count_read (gsize len);
+void po_count_written (gsize len);
 
 #endif /* PO_GRAM_H */
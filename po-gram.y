@@ -8,6 +8,7 @@
  */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -15,35 +16,75 @@
 #include <string.h>
 #include <glib.h>
 #include "po-gram.h"
-#include "common.h"
 #include "i18n.h"
 
-extern int polineno;
-int polex (void);
-void poerror (const char *s);
+static StringBlock *concat_strings (PoArena *arena, GSList *slist);
+static StringBlock *concat_unless (PoParser *parser, po_write_modes part, GSList *slist);
 
-static GSList *entries = NULL, *obsolete_entries = NULL;
-static StringBlock *concat_strings (GSList *slist);
+/* The location of a rule starts with its first non-empty part, so that an
+ * entry starts with its first comment, not with the end of the previous one. */
+#define YYLLOC_DEFAULT(cur, rhs, n) po_location_span (&(cur), &YYRHSLOC (rhs, 0), n)
 
 %}
 
+%code requires {
+/* Comments of an entry, as collected by the parser. Like all the other lists
+ * built by the grammar, they are kept in reverse order, so that adding an
+ * item does not need to walk the whole list. */
+typedef struct {
+	GSList *std, *pos, *res;
+	GSList *spec;
+	PoEntryFlags flags;     /* found in spec */
+} PoCommentLists;
+
+/* A msgstr[n] as parsed. Its strings are only put together once the entry
+ * is kept. */
+typedef struct {
+	int n;
+	GSList *strings;
+} PoParsedMsgStrX;
+
+/* Byte offsets from the start of the file, and the line where it starts. */
+typedef struct {
+	gsize start, end;
+	int line;
+} PoLocation;
+}
+
+%code {
+int polex (YYSTYPE *lvalp, YYLTYPE *llocp, void *scanner);
+void poerror (YYLTYPE *llocp, PoParser *parser, void *scanner, const char *s);
+static void po_location_span (PoLocation *cur, PoLocation *rhs, int n);
+static gboolean keep_entry (PoParser *parser, PoEntry *po, PoCommentLists *comments, GSList *id, gboolean translated, gboolean is_obsolete);
+static gboolean strings_empty (GSList *slist);
+static gboolean msgstrxs_translated (GSList *msgstrxs);
+static void init_entry (PoParser *parser, PoEntry *po, PoLocation *loc, PoCommentLists *comments, PoPrevious *previous, StringBlock *ctx, GSList *id);
+static void set_msgstrxs (PoParser *parser, PoEntry *po, GSList *msgstrxs);
+static void emit_entry (PoParser *parser, PoEntry *po, gboolean is_obsolete);
+}
+
+%define api.pure full
 %define parse.error verbose
+%define api.location.type {PoLocation}
+%locations
+%parse-param {PoParser *parser} {void *scanner}
+%lex-param {void *scanner}
 
 %union {
 	int int_val;
 	char *str_val;
 	StringBlock *stringblock_val;
 	GSList *gslist_val;
-	PoEntry *entry_val;
-	PoComments comments_val;
+	PoCommentLists comments_val;
 	PoPrevious previous_val;
-	MsgStrX *msgstrx_val;
+	PoParsedMsgStrX *msgstrx_val;
 }
 
 %token MSGCTXT PREVIOUS_MSGCTXT OBSOLETE_MSGCTXT OBSOLETE_PREVIOUS_MSGCTXT
 %token MSGID MSGID_PLURAL PREVIOUS_MSGID PREVIOUS_MSGID_PLURAL
 %token OBSOLETE_MSGID OBSOLETE_MSGID_PLURAL OBSOLETE_PREVIOUS_MSGID OBSOLETE_PREVIOUS_MSGID_PLURAL
 %token MSGSTR OBSOLETE_MSGSTR INVALID
+%token CHUNK_START
 %token <str_val> MSGSTR_X
 %token <str_val> STRING
 %token <str_val> OBSOLETE_STRING
@@ -63,8 +104,6 @@ static StringBlock *concat_strings (GSList *slist);
 %type <gslist_val> string_list
 %type <gslist_val> obsolete_string_list
 %type <gslist_val> really_obsolete_string_list
-%type <gslist_val> msg_list
-%type <gslist_val> obsolete_msg_list
 %type <gslist_val> msgstr_x_list
 %type <gslist_val> obsolete_msgstr_x_list
 %type <msgstrx_val> msgstr_x
@@ -72,45 +111,31 @@ static StringBlock *concat_strings (GSList *slist);
 %type <comments_val> comments
 %type <previous_val> previous
 %type <previous_val> obsolete_previous
-%type <entry_val> msg
-%type <entry_val> obsolete_msg
 
 %start translation_unit
 %%
 
 translation_unit
 	: msg_list
-	{
-		entries = g_slist_reverse ($1);
-		obsolete_entries = NULL;
-	}
 	| msg_list obsolete_msg_list
-	{
-		entries = g_slist_reverse ($1);
-		obsolete_entries = g_slist_reverse ($2);
-	}
+	| CHUNK_START chunk
+	;
+
+/* A part of a file, see po_read_parallel() */
+chunk
+	: msg_list
+	| msg_list obsolete_msg_list
+	| obsolete_msg_list
 	;
 
 msg_list
 	: msg
-	{
-		$$ = g_slist_append (NULL, $1);
-	}
 	| msg_list msg
-	{
-		$$ = g_slist_prepend ($1, $2);
-	}
 	;
 
 obsolete_msg_list
 	: obsolete_msg
-	{
-		$$ = g_slist_append (NULL, $1);
-	}
 	| obsolete_msg_list obsolete_msg
-	{
-		$$ = g_slist_prepend ($1, $2);
-	}
 	;
 
 comments
@@ -120,26 +145,36 @@ comments
 		$$.pos = NULL;
 		$$.spec = NULL;
 		$$.res = NULL;
+		$$.flags = 0;
 	}
 	| comments COMMENT_STD
 	{
 		$$ = $1;
-		$$.std =  g_slist_append ($$.std, $2);
+		if ($2 != NULL)
+			$$.std = po_arena_slist_prepend (parser->arena, $$.std, $2);
 	}
 	| comments COMMENT_POS
 	{
 		$$ = $1;
-		$$.pos =  g_slist_append ($$.pos, $2);
+		if ($2 != NULL)
+			$$.pos = po_arena_slist_prepend (parser->arena, $$.pos, $2);
 	}
 	| comments COMMENT_SPECIAL
 	{
 		$$ = $1;
-		$$.spec =  g_slist_append ($$.spec, $2);
+		/* the flags are needed even when the comments are not */
+		if (!(parser->omit & NO_SPEC_COMMENT))
+			$$.spec = po_arena_slist_prepend (parser->arena, $$.spec, $2);
+		if (strstr ($2, " fuzzy") != NULL)
+			$$.flags |= PO_FUZZY;
+		if (strstr ($2, " c-format") != NULL)
+			$$.flags |= PO_C_FORMAT;
 	}
 	| comments COMMENT_RESERVED
 	{
 		$$ = $1;
-		$$.res =  g_slist_append ($$.res, $2);
+		if ($2 != NULL)
+			$$.res = po_arena_slist_prepend (parser->arena, $$.res, $2);
 	}
 	;
 
@@ -150,8 +185,7 @@ previous_ctx
 	}
 	| PREVIOUS_MSGCTXT string_list
 	{
-		$$ = concat_strings($2);
-		g_slist_free_custom ($2, g_free);
+		$$ = concat_unless (parser, NO_PREVIOUS, $2);
 	}
 	;
 
@@ -162,8 +196,7 @@ previous_id
 	}
 	| PREVIOUS_MSGID string_list
 	{
-		$$ = concat_strings($2);
-		g_slist_free_custom ($2, g_free);
+		$$ = concat_unless (parser, NO_PREVIOUS, $2);
 	}
 	;
 
@@ -174,8 +207,7 @@ previous_id_plural
 	}
 	| PREVIOUS_MSGID_PLURAL string_list
 	{
-		$$ = concat_strings($2);
-		g_slist_free_custom ($2, g_free);
+		$$ = concat_unless (parser, NO_PREVIOUS, $2);
 	}
 	;
 
@@ -195,8 +227,7 @@ obsolete_previous_ctx
 	}
 	| OBSOLETE_PREVIOUS_MSGCTXT string_list
 	{
-		$$ = concat_strings($2);
-		g_slist_free_custom ($2, g_free);
+		$$ = concat_unless (parser, NO_PREVIOUS, $2);
 	}
 	;
 
@@ -207,8 +238,7 @@ obsolete_previous_id
 	}
 	| OBSOLETE_PREVIOUS_MSGID string_list
 	{
-		$$ = concat_strings($2);
-		g_slist_free_custom ($2, g_free);
+		$$ = concat_unless (parser, NO_PREVIOUS, $2);
 	}
 	;
 
@@ -219,8 +249,7 @@ obsolete_previous_id_plural
 	}
 	| OBSOLETE_PREVIOUS_MSGID_PLURAL string_list
 	{
-		$$ = concat_strings($2);
-		g_slist_free_custom ($2, g_free);
+		$$ = concat_unless (parser, NO_PREVIOUS, $2);
 	}
 	;
 
@@ -236,44 +265,40 @@ obsolete_previous
 msgstr_x
 	: MSGSTR MSGSTR_X string_list
 	{
-		$$ = g_new(MsgStrX, 1);
+		$$ = po_arena_new_struct (parser->arena, PoParsedMsgStrX, 1);
 		$$->n = atoi($2);
-		$$->str = concat_strings ($3);
-		g_free ($2);
-		g_slist_free_custom ($3, g_free);
+		$$->strings = $3;
 	}
 	;
 
 obsolete_msgstr_x
 	: OBSOLETE_MSGSTR MSGSTR_X obsolete_string_list
 	{
-		$$ = g_new(MsgStrX, 1);
+		$$ = po_arena_new_struct (parser->arena, PoParsedMsgStrX, 1);
 		$$->n = atoi($2);
-		$$->str = concat_strings ($3);
-		g_free ($2);
-		g_slist_free_custom ($3, g_free);
+		$$->strings = $3;
 	}
 	;
 
 msgstr_x_list
 	: msgstr_x
 	{
-		$$ = g_slist_append (NULL, $1);
+		$$ = po_arena_slist_prepend (parser->arena, NULL, $1);
 	}
 	| msgstr_x_list msgstr_x
 	{
-		$$ = g_slist_append ($1, $2);
+		$$ = po_arena_slist_prepend (parser->arena, $1, $2);
 	}
 	;
 
 obsolete_msgstr_x_list
 	: obsolete_msgstr_x
 	{
-		$$ = g_slist_append (NULL, $1);
+		$$ = po_arena_slist_prepend (parser->arena, NULL, $1);
 	}
 	| obsolete_msgstr_x_list obsolete_msgstr_x
 	{
-		$$ = g_slist_append ($1, $2);
+		$$ = po_arena_slist_prepend (parser->arena, $1, $2);
 	}
 	;
 
@@ -284,8 +309,7 @@ msgctx
 	}
 	| MSGCTXT string_list
 	{
-		$$ = concat_strings ($2);
-		g_slist_free_custom ($2, g_free);
+		$$ = concat_unless (parser, NO_CTX, $2);
 	}
 	;
 
@@ -296,215 +320,592 @@ obsolete_msgctx
 	}
 	| OBSOLETE_MSGCTXT obsolete_string_list
 	{
-		$$ = concat_strings ($2);
-		g_slist_free_custom ($2, g_free);
+		$$ = concat_unless (parser, NO_CTX, $2);
 	}
 	;
 
 msg
 	: comments previous msgctx MSGID string_list MSGSTR string_list
 	{
-		GSList *l;
-
-		$$ = g_new (PoEntry, 1);
-		$$->ctx = $3;
-		$$->id = concat_strings ($5);
-		$$->id_plural = NULL;
-		$$->str = concat_strings ($7);
-		$$->msgstrxs = NULL;
-		$$->comments = $1;
-		$$->previous = $2;
-		$$->is_fuzzy = $$->is_c_format = 0;
-		for (l = $$->comments.spec; l != NULL; l = l->next) {
-			char *s = l->data;
-
-			if (strstr (s, " fuzzy") != NULL) {
-				$$->is_fuzzy = 1;
-			}
-			if (strstr (s, " c-format") != NULL) {
-				$$->is_c_format = 1;
-			}
+		PoEntry po, *kept = NULL;
+		if (keep_entry (parser, &po, &$1, $5, !strings_empty ($7), FALSE)) {
+			init_entry (parser, &po, &@$, &$1, &$2, $3, $5);
+			po.str = concat_unless (parser, NO_STR | NO_TRANSLATION, $7);
+			kept = &po;
 		}
-		g_slist_free_custom ($5, g_free);
-		g_slist_free_custom ($7, g_free);
+		emit_entry (parser, kept, FALSE);
 	}
 	| comments previous msgctx MSGID string_list MSGID_PLURAL string_list msgstr_x_list
 	{
-		GSList *l;
-
-		$$ = g_new (PoEntry, 1);
-		$$->ctx = $3;
-		$$->id = concat_strings ($5);
-		$$->id_plural = concat_strings ($7);
-		$$->str = NULL;
-		$$->msgstrxs = $8;
-		$$->comments = $1;
-		$$->previous = $2;
-		$$->is_fuzzy = $$->is_c_format = 0;
-		for (l = $$->comments.spec; l != NULL; l = l->next) {
-			char *s = l->data;
-
-			if (strstr (s, " fuzzy") != NULL) {
-				$$->is_fuzzy = 1;
-			}
-			if (strstr (s, " c-format") != NULL) {
-				$$->is_c_format = 1;
-			}
+		PoEntry po, *kept = NULL;
+		if (keep_entry (parser, &po, &$1, $5, msgstrxs_translated ($8), FALSE)) {
+			init_entry (parser, &po, &@$, &$1, &$2, $3, $5);
+			po.id_plural = concat_unless (parser, NO_ID, $7);
+			set_msgstrxs (parser, &po, $8);
+			kept = &po;
 		}
-		g_slist_free_custom ($5, g_free);
-		g_slist_free_custom ($7, g_free);
+		emit_entry (parser, kept, FALSE);
 	}
 	;
 
 obsolete_msg
 	: comments obsolete_previous obsolete_msgctx OBSOLETE_MSGID obsolete_string_list OBSOLETE_MSGSTR obsolete_string_list
 	{
-		GSList *l;
-
-		$$ = g_new (PoEntry, 1);
-		$$->ctx = $3;
-		$$->id = concat_strings ($5);
-		$$->id_plural = NULL;
-		$$->str = concat_strings ($7);
-		$$->msgstrxs = NULL;
-		$$->comments = $1;
-		$$->previous = $2;
-		$$->is_fuzzy = $$->is_c_format = 0;
-		for (l = $$->comments.spec; l != NULL; l = l->next) {
-			char *s = l->data;
-
-			if (strstr (s, " fuzzy") != NULL) {
-				$$->is_fuzzy = 1;
-			}
-			if (strstr (s, " c-format") != NULL) {
-				$$->is_c_format = 1;
-			}
+		PoEntry po, *kept = NULL;
+		if (keep_entry (parser, &po, &$1, $5, !strings_empty ($7), TRUE)) {
+			init_entry (parser, &po, &@$, &$1, &$2, $3, $5);
+			po.str = concat_unless (parser, NO_STR | NO_TRANSLATION, $7);
+			kept = &po;
 		}
-		g_slist_free_custom ($5, g_free);
-		g_slist_free_custom ($7, g_free);
+		emit_entry (parser, kept, TRUE);
 	}
 	| comments obsolete_previous obsolete_msgctx OBSOLETE_MSGID obsolete_string_list OBSOLETE_MSGID_PLURAL obsolete_string_list obsolete_msgstr_x_list
 	{
-		GSList *l;
-
-		$$ = g_new (PoEntry, 1);
-		$$->ctx = $3;
-		$$->id = concat_strings ($5);
-		$$->id_plural = concat_strings ($7);
-		$$->str = NULL;
-		$$->msgstrxs = $8;
-		$$->comments = $1;
-		$$->previous = $2;
-		$$->is_fuzzy = $$->is_c_format = 0;
-		for (l = $$->comments.spec; l != NULL; l = l->next) {
-			char *s = l->data;
-
-			if (strstr (s, " fuzzy") != NULL) {
-				$$->is_fuzzy = 1;
-			}
-			if (strstr (s, " c-format") != NULL) {
-				$$->is_c_format = 1;
-			}
+		PoEntry po, *kept = NULL;
+		if (keep_entry (parser, &po, &$1, $5, msgstrxs_translated ($8), TRUE)) {
+			init_entry (parser, &po, &@$, &$1, &$2, $3, $5);
+			po.id_plural = concat_unless (parser, NO_ID, $7);
+			set_msgstrxs (parser, &po, $8);
+			kept = &po;
 		}
-		g_slist_free_custom ($5, g_free);
-		g_slist_free_custom ($7, g_free);
+		emit_entry (parser, kept, TRUE);
 	}
 	;
 
 string_list
 	: STRING
 	{
-		$$ = g_slist_append (NULL, $1);
+		$$ = po_arena_slist_prepend (parser->arena, NULL, $1);
 	}
 	| string_list STRING
 	{
-		$$ = g_slist_append ($1, $2);
+		$$ = po_arena_slist_prepend (parser->arena, $1, $2);
 	}
 	;
 
 obsolete_string_list
 	: STRING
 	{
-		$$ = g_slist_append (NULL, $1);
+		$$ = po_arena_slist_prepend (parser->arena, NULL, $1);
 	}
 	| STRING really_obsolete_string_list
 	{
-		$$ = g_slist_prepend ($2, $1);
+		$$ = g_slist_concat ($2, po_arena_slist_prepend (parser->arena, NULL, $1));
 	}
 	;
 
 really_obsolete_string_list
 	: OBSOLETE_STRING
 	{
-		$$ = g_slist_append (NULL, $1);
+		$$ = po_arena_slist_prepend (parser->arena, NULL, $1);
 	}
 	| really_obsolete_string_list OBSOLETE_STRING
 	{
-		$$ = g_slist_append ($1, $2);
+		$$ = po_arena_slist_prepend (parser->arena, $1, $2);
 	}
 	;
 
 /* ---------- ---------- */
 
 %%
-#include <stdio.h>
-
-extern char potext[];
-extern int column;
-
-void po_init_parser (void)
-{
-}
 
+/* Note that slist is in reverse order. */
 static StringBlock*
-concat_strings (GSList *slist)
+concat_strings (PoArena *arena, GSList *slist)
 {
 	GSList *l;
-	int total_len = 0, i = 0;
+	int total_len = 0, i;
 	char *p;
-	StringBlock *ret = g_new(StringBlock, 1);
+	StringBlock *ret = po_arena_new_struct (arena, StringBlock, 1);
 	ret->num_lines = 0;
 
 	for (l = slist; l != NULL; l = l->next) {
 		total_len += strlen (l->data);
 		ret->num_lines++;
 	}
-	ret->str = g_malloc (total_len + 1);
-	ret->line_lengths = g_malloc (sizeof(int) * ret->num_lines);
-	p = ret->str;
+	ret->line_lengths = po_arena_new_struct (arena, int, ret->num_lines);
+	if (ret->num_lines == 1) {
+		/* the token points into the input buffer, no need to copy it */
+		ret->str = slist->data;
+		ret->line_lengths[0] = total_len;
+		return ret;
+	}
+	ret->str = po_arena_alloc (arena, total_len + 1);
+	ret->str[total_len] = '\0';
+	p = ret->str + total_len;
+	i = ret->num_lines;
 	for (l = slist; l != NULL; l = l->next) {
 		char *s = l->data;
 		int len = strlen (s);
-		if (len > 0) {
-			memmove (p, s, len);
-			p += len;
-		}
-		ret->line_lengths[i++] = len;
+		p -= len;
+		memcpy (p, s, len);
+		ret->line_lengths[--i] = len;
 	}
-	ret->str[total_len] = '\0';
 	return ret;
 }
 
+static StringBlock *
+concat_unless (PoParser *parser, po_write_modes part, GSList *slist)
+{
+	return parser->omit & part ? NULL : concat_strings (parser->arena, slist);
+}
+
+/* Note that slist is in reverse order. */
+static PoLines
+list_to_lines (PoArena *arena, GSList *slist)
+{
+	PoLines ret;
+	GSList *l;
+	int i;
+
+	ret.n = g_slist_length (slist);
+	ret.lines = ret.n > 0 ? po_arena_new_struct (arena, char *, ret.n) : NULL;
+	i = ret.n;
+	for (l = slist; l != NULL; l = l->next) {
+		ret.lines[--i] = l->data;
+	}
+	return ret;
+}
+
+static gboolean
+strings_empty (GSList *slist)
+{
+	for (; slist != NULL; slist = slist->next) {
+		if (*(char *) slist->data != '\0')
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+msgstrxs_translated (GSList *msgstrxs)
+{
+	for (; msgstrxs != NULL; msgstrxs = msgstrxs->next) {
+		if (strings_empty (((PoParsedMsgStrX *) msgstrxs->data)->strings))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* Sets the flags of a just parsed entry, and returns whether it passes the
+ * filters. Only then is the rest of the entry worth putting together. */
+static gboolean
+keep_entry (PoParser *parser, PoEntry *po, PoCommentLists *comments, GSList *id, gboolean translated, gboolean is_obsolete)
+{
+	parser->n_parsed++;
+	po->flags = comments->flags;
+	if (translated)
+		po->flags |= PO_TRANSLATED;
+	if (strings_empty (id))
+		po->flags |= PO_HEADER;
+	if (is_obsolete) {
+		po->flags |= PO_OBSOLETE;
+		parser->parsed_obsolete = TRUE;
+	} else {
+		parser->parsed_entry = TRUE;
+	}
+	return po_entry_filter (po, parser->filters);
+}
+
+/* Fills in everything but the flags, the translation and msgid_plural. */
+static void
+init_entry (PoParser *parser, PoEntry *po, PoLocation *loc, PoCommentLists *comments, PoPrevious *previous, StringBlock *ctx, GSList *id)
+{
+	PoArena *arena = parser->arena;
+
+	po->comments.std = list_to_lines (arena, comments->std);
+	po->comments.pos = list_to_lines (arena, comments->pos);
+	po->comments.res = list_to_lines (arena, comments->res);
+	po->comments.spec = list_to_lines (arena, comments->spec);
+	po->previous = *previous;
+	po->ctx = ctx;
+	po->id = concat_unless (parser, NO_ID, id);
+	po->hash = parser->omit & (NO_CTX | NO_ID) ? 0 : po_entry_hash (ctx, po->id);
+	po->id_plural = NULL;
+	po->str = NULL;
+	po->msgstrxs = NULL;
+	po->n_msgstrxs = 0;
+	po->offset = loc->start;
+	po->length = loc->end - loc->start;
+	po->line = loc->line;
+}
+
+/* Note that msgstrxs is in reverse order. */
+static void
+set_msgstrxs (PoParser *parser, PoEntry *po, GSList *msgstrxs)
+{
+	GSList *l;
+	int i;
+
+	if (parser->omit & (NO_STR | NO_TRANSLATION))
+		return;
+	po->n_msgstrxs = g_slist_length (msgstrxs);
+	po->msgstrxs = po_arena_new_struct (parser->arena, MsgStrX, po->n_msgstrxs);
+	i = po->n_msgstrxs;
+	for (l = msgstrxs; l != NULL; l = l->next) {
+		PoParsedMsgStrX *m = l->data;
+
+		po->msgstrxs[--i].n = m->n;
+		po->msgstrxs[i].str = concat_strings (parser->arena, m->strings);
+	}
+}
+
+/* Passes po, unless it is NULL, to the callback.
+ *
+ * When streaming, the entry's memory is reused once the callback returns.
+ * Bison may already hold the first token of the next entry, which was
+ * allocated from the current arena, so two arenas are used in turns and
+ * only the older one is cleared. */
+static void
+emit_entry (PoParser *parser, PoEntry *po, gboolean is_obsolete)
+{
+	if (po != NULL) {
+		parser->n_kept++;
+		parser->entry_func (po, is_obsolete, parser->entry_data);
+	}
+	if (parser->spare_arena != NULL) {
+		PoArena *tmp = parser->spare_arena;
+
+		po_arena_clear (tmp);
+		parser->spare_arena = parser->arena;
+		parser->arena = tmp;
+		po_scan_discard_consumed (parser);
+	}
+}
+
+static void
+po_location_span (PoLocation *cur, PoLocation *rhs, int n)
+{
+	int k = 1;
+
+	if (n == 0) {
+		cur->start = cur->end = rhs[0].end;
+		cur->line = 0;
+		return;
+	}
+	while (k < n && rhs[k].start == rhs[k].end)
+		k++;
+	cur->start = rhs[k].start;
+	cur->line = rhs[k].line;
+	cur->end = rhs[n].end;
+}
+
 void
-poerror (const char *s)
+poerror (YYLTYPE *llocp, PoParser *parser, void *scanner, const char *s)
 {
-	fflush (stdout);
-	po_error (_("Parse error at line %d: %s\n"), polineno, s);
+	if (parser->error == NULL) {
+		g_set_error (&parser->error, PO_ERROR, PO_ERROR_PARSE,
+		             _("Parse error at line %d: %s"), po_scan_lineno (parser), s);
+	}
+}
+
+/* Runs the parser on an opened scanner, and closes it. */
+static gboolean
+po_parse (PoParser *parser, GError **error)
+{
+	PoCounters delta = { 0 };
+
+	poparse (parser, parser->scanner);
+	po_scan_close (parser);
+	/* buffers count as read once they are filled */
+	if (parser->input == NULL)
+		delta.bytes_read = parser->offset;
+	delta.tokens = parser->n_tokens;
+	delta.entries_parsed = parser->n_parsed;
+	delta.entries_kept = parser->n_kept;
+	po_counters_add (&delta);
+	if (parser->error != NULL) {
+		g_propagate_error (error, parser->error);
+		parser->error = NULL;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+po_file_add_entry (PoEntry *po, gboolean is_obsolete, gpointer data)
+{
+	PoFile *pof = data;
+
+	g_array_append_val (is_obsolete ? pof->obsolete_entries : pof->entries, *po);
 }
 
 PoFile *
-po_read (char *fn)
+po_read (const char *fn, PoFilters filters, GError **error)
 {
+	PoParser parser = { NULL };
 	PoFile *pof;
+	PoBuffer *buf;
 
-	po_scan_open_file (fn);
-	po_init_parser ();
-	poparse ();
-	po_scan_close_file ();
-
+	if ((buf = po_buffer_read (fn, error)) == NULL)
+		return NULL;
 	pof = g_new (PoFile, 1);
-	pof->entries = entries;
-	pof->obsolete_entries = obsolete_entries;
-
+	pof->arena = po_arena_new ();
+	pof->buffer = buf;
+	pof->adopted_buffers = NULL;
+	pof->entries = g_array_new (FALSE, FALSE, sizeof (PoEntry));
+	pof->obsolete_entries = g_array_new (FALSE, FALSE, sizeof (PoEntry));
+
+	parser.arena = pof->arena;
+	parser.entry_func = po_file_add_entry;
+	parser.entry_data = pof;
+	parser.filters = filters;
+	if (!po_scan_open_buffer (&parser, buf, error) || !po_parse (&parser, error)) {
+		po_free (pof);
+		return NULL;
+	}
 	return pof;
 }
+
+/* Mappable files are scanned in place, and the pages already parsed are
+ * dropped as we go. Anything else is read through a stdio stream, with the
+ * tokens copied out of the scanner's buffer. Either way memory use depends
+ * on the size of the largest entry, not of the file.
+ */
+gboolean
+po_parse_stream (const char *fn, PoFilters filters, po_write_modes omit, PoEntryFunc *func, gpointer data, GError **error)
+{
+	PoParser parser = { NULL };
+	PoBuffer *buf;
+	FILE *f = NULL;
+	gboolean ret;
+	int fd;
+
+	if ((fd = po_input_open (fn, error)) < 0)
+		return FALSE;
+	if ((buf = po_buffer_map (fd)) == NULL) {
+		f = fd == STDIN_FILENO ? stdin : fdopen (fd, "r");
+		if (f == NULL) {
+			g_set_error (error, PO_ERROR, PO_ERROR_OPEN,
+			             _("Can't open input file: %s"), fn);
+			close (fd);
+			return FALSE;
+		}
+	}
+
+	parser.arena = po_arena_new ();
+	parser.spare_arena = po_arena_new ();
+	parser.entry_func = func;
+	parser.entry_data = data;
+	parser.filters = filters;
+	parser.omit = omit;
+	if (buf != NULL) {
+		ret = po_scan_open_buffer (&parser, buf, error);
+	} else {
+		ret = po_scan_open_stream (&parser, f, error);
+	}
+	ret = ret && po_parse (&parser, error);
+
+	if (f != NULL && f != stdin) {
+		fclose (f);
+	} else if (f == NULL && fd != STDIN_FILENO) {
+		close (fd);
+	}
+	po_buffer_free (buf);
+	po_arena_free (parser.arena);
+	po_arena_free (parser.spare_arena);
+	return ret;
+}
+
+/* Parses a part of a file which starts and ends at entry boundaries, and
+ * was found at offset and line of the whole file, adding its entries to
+ * pof. The part may hold obsolete entries only, or none at all. */
+gboolean
+po_parse_part (PoFile *pof, PoBuffer *buf, gsize offset, int line, GError **error)
+{
+	PoParser parser = { NULL };
+
+	parser.arena = pof->arena;
+	parser.entry_func = po_file_add_entry;
+	parser.entry_data = pof;
+	parser.start_token = CHUNK_START;
+	parser.offset = offset;
+	parser.line = line;
+	return po_scan_open_buffer (&parser, buf, error) && po_parse (&parser, error);
+}
+
+/* -- parallel parsing -- */
+
+/* Below this size, chunks are not worth a thread. */
+#define MIN_CHUNK_SIZE (256 * 1024)
+
+typedef struct {
+	PoBuffer buf;           /* a part of the file's buffer */
+	PoFile pof;             /* only the tables and the arena are used */
+	PoParser parser;
+	gboolean ok;
+} PoChunk;
+
+/* Returns TRUE if p, which follows an empty line, looks like the start of
+ * an entry rather than a continuation of the previous one. */
+static gboolean
+is_entry_start (const char *p, const char *end)
+{
+	gsize left = end - p;
+
+	if (left >= 7 && strncmp (p, "msgctxt", 7) == 0)
+		return TRUE;
+	if (left >= 6 && strncmp (p, "msgid", 5) == 0 && p[5] != '_')
+		return TRUE;
+	if (left >= 3 && p[0] == '#') {
+		if (p[1] != '~')
+			return TRUE;
+		/* obsolete entries may contain empty lines, too */
+		return p[2] == '|' ||
+		       (left >= 9 && strncmp (p + 2, " msgctxt", 8) == 0) ||
+		       (left >= 10 && strncmp (p + 2, " msgid", 6) == 0 && p[8] != '_');
+	}
+	return FALSE;
+}
+
+/* Returns the start of the first entry after from which follows an empty
+ * line, or NULL. */
+static char *
+find_entry_start (char *from, char *end)
+{
+	char *p = from;
+
+	while ((p = memchr (p, '\n', end - p)) != NULL && p + 2 < end) {
+		p++;
+		if (*p == '\n' && is_entry_start (p + 1, end))
+			return p + 1;
+	}
+	return NULL;
+}
+
+static gpointer
+po_parse_chunk (gpointer data)
+{
+	PoChunk *c = data;
+
+	c->ok = po_scan_open_buffer (&c->parser, &c->buf, NULL) && po_parse (&c->parser, NULL);
+	return NULL;
+}
+
+/* Like po_read(), but for big files splits the input at empty lines that
+ * are followed by the start of an entry, and parses the parts in separate
+ * threads. The two newlines before each split point are overwritten with
+ * the NULs that flex wants at the end of its buffer.
+ *
+ * The guessed split points may be wrong, for example with empty lines
+ * inside an entry. The grammar cannot accept a part which does not start
+ * and end at entry boundaries, though, so whenever any part fails to parse,
+ * or obsolete entries would come before normal ones, the whole file is
+ * simply read again by po_read(). This also gives the same error messages
+ * and line numbers as po_read().
+ */
+PoFile *
+po_read_parallel (const char *fn, int n_threads, PoFilters filters, GError **error)
+{
+	PoChunk *chunks;
+	GThread **threads;
+	PoBuffer *buf;
+	PoFile *pof;
+	gboolean ok = TRUE, seen_obsolete = FALSE;
+	char *start, *end;
+	int fd, i, n, line;
+
+	if (n_threads <= 1)
+		return po_read (fn, filters, error);
+	if ((fd = po_input_open (fn, error)) < 0)
+		return NULL;
+	buf = po_buffer_map (fd);
+	if (fd != STDIN_FILENO)
+		close (fd);
+	/* falling back needs a fresh copy of the file, so only regular files
+	 * are split */
+	if (buf == NULL || buf->len < 2 * MIN_CHUNK_SIZE) {
+		po_buffer_free (buf);
+		return po_read (fn, filters, error);
+	}
+	if (buf->map_len != 0)
+		madvise (buf->data, buf->len, MADV_WILLNEED);
+	if (n_threads > buf->len / MIN_CHUNK_SIZE)
+		n_threads = buf->len / MIN_CHUNK_SIZE;
+
+	chunks = g_new0 (PoChunk, n_threads);
+	threads = g_new (GThread *, n_threads);
+	start = buf->data;
+	end = buf->data + buf->len;
+	for (n = 0; n < n_threads; n++) {
+		char *next = NULL;
+
+		if (n < n_threads - 1) {
+			char *target = buf->data + buf->len / n_threads * (n + 1);
+
+			next = find_entry_start (MAX (target, start), end);
+		}
+		chunks[n].buf.data = start;
+		if (next != NULL) {
+			next[-2] = next[-1] = '\0';
+			chunks[n].buf.len = next - start - PO_BUFFER_PADDING;
+		} else {
+			chunks[n].buf.len = end - start;
+		}
+		chunks[n].pof.arena = chunks[n].parser.arena = po_arena_new ();
+		chunks[n].pof.entries = g_array_new (FALSE, FALSE, sizeof (PoEntry));
+		chunks[n].pof.obsolete_entries = g_array_new (FALSE, FALSE, sizeof (PoEntry));
+		chunks[n].parser.entry_func = po_file_add_entry;
+		chunks[n].parser.entry_data = &chunks[n].pof;
+		chunks[n].parser.filters = filters;
+		chunks[n].parser.offset = start - buf->data;
+		if (n > 0)
+			chunks[n].parser.start_token = CHUNK_START;
+		if (next == NULL) {
+			n++;
+			break;
+		}
+		start = next;
+	}
+
+	for (i = 1; i < n; i++) {
+		threads[i] = g_thread_new ("po-parse", po_parse_chunk, &chunks[i]);
+	}
+	po_parse_chunk (&chunks[0]);
+	for (i = 1; i < n; i++) {
+		g_thread_join (threads[i]);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!chunks[i].ok || (seen_obsolete && chunks[i].parser.parsed_entry))
+			ok = FALSE;
+		if (chunks[i].parser.parsed_obsolete)
+			seen_obsolete = TRUE;
+	}
+
+	/* lines are counted from the start of each chunk, so those of the
+	 * previous ones, and the two newlines between, are added */
+	for (i = 1, line = 0; ok && i < n; i++) {
+		line += chunks[i - 1].parser.line - 1 + PO_BUFFER_PADDING;
+		po_entries_shift (chunks[i].pof.entries, 0, line);
+		po_entries_shift (chunks[i].pof.obsolete_entries, 0, line);
+	}
+
+	pof = NULL;
+	if (ok) {
+		pof = g_new (PoFile, 1);
+		pof->buffer = buf;
+		pof->adopted_buffers = NULL;
+		pof->arena = chunks[0].pof.arena;
+		pof->entries = chunks[0].pof.entries;
+		pof->obsolete_entries = chunks[0].pof.obsolete_entries;
+		for (i = 1; i < n; i++) {
+			g_array_append_vals (pof->entries, chunks[i].pof.entries->data, chunks[i].pof.entries->len);
+			g_array_append_vals (pof->obsolete_entries, chunks[i].pof.obsolete_entries->data, chunks[i].pof.obsolete_entries->len);
+			g_array_free (chunks[i].pof.entries, TRUE);
+			g_array_free (chunks[i].pof.obsolete_entries, TRUE);
+			po_arena_adopt (pof->arena, chunks[i].pof.arena);
+		}
+	} else {
+		for (i = 0; i < n; i++) {
+			g_array_free (chunks[i].pof.entries, TRUE);
+			g_array_free (chunks[i].pof.obsolete_entries, TRUE);
+			po_arena_free (chunks[i].pof.arena);
+		}
+		po_buffer_free (buf);
+	}
+	g_free (threads);
+	g_free (chunks);
+
+	return pof != NULL ? pof : po_read (fn, filters, error);
+}
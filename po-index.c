@@ -0,0 +1,106 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#include <string.h>
+#include <glib.h>
+#include "libpotool.h"
+
+/* An open addressing table with linear probing. It is kept at most half
+ * full, and every slot caches the hash of its entry, so that most probes
+ * never touch the strings. */
+typedef struct {
+	guint hash;
+	PoEntry *po;    /* NULL if the slot is free */
+} PoIndexSlot;
+
+struct _PoIndex {
+	PoIndexSlot *slots;
+	guint mask;
+};
+
+/* FNV-1a */
+static guint
+hash_bytes (guint h, const char *s)
+{
+	for (; *s != '\0'; s++) {
+		h = (h ^ (guchar) *s) * 16777619U;
+	}
+	return h;
+}
+
+/* The context is followed by an EOT, like in mo files, so that it can't
+ * run into the msgid. */
+guint
+po_entry_hash (StringBlock *ctx, StringBlock *id)
+{
+	guint h = 2166136261U;
+
+	if (ctx != NULL) {
+		h = hash_bytes (h, ctx->str);
+		h = (h ^ 4) * 16777619U;
+	}
+	return hash_bytes (h, id->str);
+}
+
+static gboolean
+same_key (PoEntry *a, PoEntry *b)
+{
+	if (a->hash != b->hash)
+		return FALSE;
+	/* always so for entries interned in the same pool, see po_intern() */
+	if (a->id == b->id && a->ctx == b->ctx)
+		return TRUE;
+	if ((a->ctx == NULL) != (b->ctx == NULL))
+		return FALSE;
+	if (a->ctx != NULL && strcmp (a->ctx->str, b->ctx->str) != 0)
+		return FALSE;
+	return strcmp (a->id->str, b->id->str) == 0;
+}
+
+/* Of entries with the same key, the last one is found. */
+PoIndex *
+po_index_new (GArray *entries)
+{
+	PoEntry *po = (PoEntry *) entries->data, *end = po + entries->len;
+	PoIndex *index = g_new (PoIndex, 1);
+	guint size = 8;
+
+	while (size < 2 * entries->len) {
+		size *= 2;
+	}
+	index->slots = g_new0 (PoIndexSlot, size);
+	index->mask = size - 1;
+
+	for (; po < end; po++) {
+		guint i = po->hash & index->mask;
+
+		while (index->slots[i].po != NULL && !same_key (index->slots[i].po, po)) {
+			i = (i + 1) & index->mask;
+		}
+		index->slots[i].hash = po->hash;
+		index->slots[i].po = po;
+	}
+	return index;
+}
+
+PoEntry *
+po_index_lookup (PoIndex *index, PoEntry *key)
+{
+	guint i = key->hash & index->mask;
+
+	for (; index->slots[i].po != NULL; i = (i + 1) & index->mask) {
+		if (index->slots[i].hash == key->hash && same_key (index->slots[i].po, key))
+			return index->slots[i].po;
+	}
+	return NULL;
+}
+
+void
+po_index_free (PoIndex *index)
+{
+	g_free (index->slots);
+	g_free (index);
+}
@@ -0,0 +1,752 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "po-gram.h"
+
+/* Suggestions are found in two steps: an index of the trigrams of the
+ * msgids gives the candidates, whose edit distance to the msgid is then
+ * worked out, giving up as soon as it is too big.
+ *
+ * A single edit changes at most three trigrams, so a msgid within distance
+ * k of another one lacks at most 3k of its trigrams. Candidates are thus
+ * only taken from the lists of the 3k + 1 rarest trigrams of the msgid, and
+ * the more common ones are merely searched for the candidates which are
+ * still in the running. Trigrams are hashed into buckets, which can only
+ * add candidates. Msgids with too few trigrams for this, or made of so
+ * common ones that it does not pay, are compared with all the remembered
+ * ones of a suitable length instead.
+ */
+
+typedef struct {
+	PoEntry *po;
+	const char *id;
+	guint len;
+	int forms;              /* of the translation, 0 without plural */
+	guint32 order;          /* in which the entries were remembered */
+} TmEntry;
+
+struct _PoMemory {
+	GArray *entries;        /* TmEntry, the shortest msgids first once indexed */
+	/* the index, made by the first lookup */
+	int bits;               /* there are 1 << bits buckets */
+	guint32 *starts;        /* of the buckets in postings, and the end */
+	guint32 *postings;      /* entry numbers, in order, for every bucket */
+	guint32 *length_starts; /* of the entries of every length */
+	guint8 *hists;          /* byte_histogram() of every msgid */
+	guint max_len;
+	/* for a single lookup */
+	guint32 *seen;          /* the lookup which last looked at an entry */
+	guint32 *hits;          /* its number of buckets found so far */
+	guint32 lookups;
+	guint32 *bucket_stamps; /* the tm_buckets() call which last found a bucket */
+	guint32 stamp;
+	GArray *candidates;     /* guint32 */
+};
+
+#define EPSILON 1e-9
+
+static guint32
+trigram_bucket (PoMemory *tm, guint32 key)
+{
+	return (key * 0x9e3779b1u) >> (32 - tm->bits);
+}
+
+/* Stores the distinct buckets of the trigrams of s in out, which has room
+ * for len + 2 of them, and returns their number. There are two NUL bytes
+ * before and after s, so that short msgids have enough trigrams too. */
+static guint
+tm_buckets (PoMemory *tm, const char *s, guint len, guint32 *out)
+{
+	guint32 key = 0, bucket;
+	guint i, n = 0;
+
+	if (++tm->stamp == 0) {
+		memset (tm->bucket_stamps, 0, sizeof (guint32) << tm->bits);
+		tm->stamp = 1;
+	}
+	for (i = 0; i < len + 2; i++) {
+		key = (key << 8 | (i < len ? (guchar) s[i] : 0)) & 0xffffff;
+		bucket = trigram_bucket (tm, key);
+		if (tm->bucket_stamps[bucket] != tm->stamp) {
+			tm->bucket_stamps[bucket] = tm->stamp;
+			out[n++] = bucket;
+		}
+	}
+	return n;
+}
+
+/* The number of bytes of s with each value of the low 5 bits, up to 255,
+ * which tells the letters apart, but not their case. */
+#define HIST_SIZE 32
+
+static void
+byte_histogram (const char *s, guint len, guint8 *hist)
+{
+	guint counts[HIST_SIZE] = { 0 }, i;
+
+	for (i = 0; i < len; i++) {
+		counts[(guchar) s[i] % HIST_SIZE]++;
+	}
+	for (i = 0; i < HIST_SIZE; i++) {
+		hist[i] = MIN (counts[i], 255);
+	}
+}
+
+/* Every edit changes the counts of byte_histogram() by one at most, up and
+ * down, so the distance is at least the sum of the counts which are bigger
+ * for one string, and the sum of those which are bigger for the other. */
+static guint
+histogram_distance (const guint8 *a, const guint8 *b)
+{
+#ifdef __SSE2__
+	__m128i more = _mm_setzero_si128 (), less = _mm_setzero_si128 ();
+	guint i, p, n;
+
+	for (i = 0; i < HIST_SIZE; i += 16) {
+		__m128i x = _mm_loadu_si128 ((const __m128i *) (a + i));
+		__m128i y = _mm_loadu_si128 ((const __m128i *) (b + i));
+
+		more = _mm_add_epi64 (more, _mm_sad_epu8 (_mm_subs_epu8 (x, y), _mm_setzero_si128 ()));
+		less = _mm_add_epi64 (less, _mm_sad_epu8 (_mm_subs_epu8 (y, x), _mm_setzero_si128 ()));
+	}
+	p = _mm_cvtsi128_si32 (more) + _mm_extract_epi16 (more, 4);
+	n = _mm_cvtsi128_si32 (less) + _mm_extract_epi16 (less, 4);
+#else
+	guint p = 0, n = 0, i;
+
+	for (i = 0; i < HIST_SIZE; i++) {
+		if (a[i] > b[i]) {
+			p += a[i] - b[i];
+		} else {
+			n += b[i] - a[i];
+		}
+	}
+#endif
+	return MAX (p, n);
+}
+
+PoMemory *
+po_memory_new (void)
+{
+	PoMemory *tm = g_new0 (PoMemory, 1);
+
+	tm->entries = g_array_new (FALSE, FALSE, sizeof (TmEntry));
+	tm->candidates = g_array_new (FALSE, FALSE, sizeof (guint32));
+	return tm;
+}
+
+static void
+tm_drop_index (PoMemory *tm)
+{
+	g_free (tm->starts);
+	g_free (tm->postings);
+	g_free (tm->length_starts);
+	g_free (tm->seen);
+	g_free (tm->hits);
+	g_free (tm->hists);
+	g_free (tm->bucket_stamps);
+	tm->starts = NULL;
+}
+
+void
+po_memory_add (PoMemory *tm, PoFile *pof)
+{
+	PoEntry *po = (PoEntry *) pof->entries->data, *end = po + pof->entries->len;
+
+	for (; po < end; po++) {
+		TmEntry e;
+
+		if ((po->flags & (PO_TRANSLATED | PO_FUZZY | PO_HEADER)) != PO_TRANSLATED)
+			continue;
+		e.po = po;
+		e.id = po->id->str;
+		e.len = strlen (e.id);
+		e.forms = po->str != NULL ? 0 : po->n_msgstrxs;
+		e.order = tm->entries->len;
+		g_array_append_val (tm->entries, e);
+	}
+	tm_drop_index (tm);
+}
+
+void
+po_memory_free (PoMemory *tm)
+{
+	if (tm == NULL)
+		return;
+	tm_drop_index (tm);
+	g_array_free (tm->entries, TRUE);
+	g_array_free (tm->candidates, TRUE);
+	g_free (tm);
+}
+
+static void
+tm_index (PoMemory *tm)
+{
+	TmEntry *entries = (TmEntry *) tm->entries->data;
+	guint n = tm->entries->len, i, j, k;
+	guint64 trigrams = 0;
+	guint32 *buckets, *next;
+	GArray *sorted;
+
+	tm->max_len = 0;
+	for (i = 0; i < n; i++) {
+		tm->max_len = MAX (tm->max_len, entries[i].len);
+		trigrams += entries[i].len + 2;
+	}
+
+	/* entries of a suitable length are looked through in order, see
+	 * tm_search_lengths() */
+	tm->length_starts = g_new0 (guint32, tm->max_len + 2);
+	for (i = 0; i < n; i++) {
+		tm->length_starts[entries[i].len + 1]++;
+	}
+	for (j = 1; j <= tm->max_len + 1; j++) {
+		tm->length_starts[j] += tm->length_starts[j - 1];
+	}
+	sorted = g_array_sized_new (FALSE, FALSE, sizeof (TmEntry), n);
+	g_array_set_size (sorted, n);
+	next = g_new (guint32, tm->max_len + 1);
+	memcpy (next, tm->length_starts, sizeof (guint32) * (tm->max_len + 1));
+	for (i = 0; i < n; i++) {
+		g_array_index (sorted, TmEntry, next[entries[i].len]++) = entries[i];
+	}
+	g_free (next);
+	g_array_free (tm->entries, TRUE);
+	tm->entries = sorted;
+	entries = (TmEntry *) sorted->data;
+
+	for (tm->bits = 10; tm->bits < 24 && (1 << tm->bits) < trigrams / 4; tm->bits++)
+		;
+
+	/* the buckets are counted first, then filled in */
+	tm->bucket_stamps = g_new0 (guint32, 1 << tm->bits);
+	tm->stamp = 0;
+	tm->starts = g_new0 (guint32, (1 << tm->bits) + 1);
+	buckets = g_new (guint32, tm->max_len + 2);
+	for (i = 0; i < n; i++) {
+		k = tm_buckets (tm, entries[i].id, entries[i].len, buckets);
+		for (j = 0; j < k; j++) {
+			tm->starts[buckets[j] + 1]++;
+		}
+	}
+	for (j = 1; j <= 1 << tm->bits; j++) {
+		tm->starts[j] += tm->starts[j - 1];
+	}
+	tm->postings = g_new (guint32, tm->starts[1 << tm->bits]);
+	next = g_new (guint32, 1 << tm->bits);
+	memcpy (next, tm->starts, sizeof (guint32) << tm->bits);
+	for (i = 0; i < n; i++) {
+		k = tm_buckets (tm, entries[i].id, entries[i].len, buckets);
+		for (j = 0; j < k; j++) {
+			tm->postings[next[buckets[j]]++] = i;
+		}
+	}
+	g_free (next);
+	g_free (buckets);
+
+	tm->hists = g_new (guint8, HIST_SIZE * n);
+	for (i = 0; i < n; i++) {
+		byte_histogram (entries[i].id, entries[i].len, tm->hists + HIST_SIZE * i);
+	}
+	tm->seen = g_new0 (guint32, n);
+	tm->hits = g_new0 (guint32, n);
+	tm->lookups = 0;
+}
+
+/* -- edit distance -- */
+
+/* The msgid being looked up. */
+typedef struct {
+	const char *s;
+	guint len;
+	guint words;            /* of 64 bits, which hold a column of bits */
+	guint64 *peq;           /* the positions of every byte in s, see tm_query_init() */
+	guint64 *pv, *mv;       /* room for a column, see distance_words() */
+	guint8 hist[HIST_SIZE];
+} TmQuery;
+
+/* The bits of word w for byte c are at peq[c * words + w]. */
+static void
+tm_query_init (TmQuery *q, const char *s, guint len)
+{
+	guint i;
+
+	q->s = s;
+	q->len = len;
+	q->words = MAX ((len + 63) / 64, 1);
+	q->peq = g_new0 (guint64, 258 * q->words);
+	q->pv = q->peq + 256 * q->words;
+	q->mv = q->pv + q->words;
+	for (i = 0; i < len; i++) {
+		q->peq[(guchar) s[i] * q->words + i / 64] |= (guint64) 1 << (i % 64);
+	}
+	byte_histogram (s, len, q->hist);
+}
+
+static void
+tm_query_clear (TmQuery *q)
+{
+	g_free (q->peq);
+}
+
+/* Myers' algorithm, which works out a whole column of the distance matrix
+ * at a time, with the query of at most 64 bytes as the bits of a word.
+ * Returns the distance, or something bigger than k if it is bigger. */
+static guint
+distance_bits (TmQuery *q, const char *b, guint lb, guint k)
+{
+	guint64 pv = ~(guint64) 0, mv = 0, last;
+	guint score = q->len, j;
+
+	if (q->len == 0)
+		return lb;
+	last = (guint64) 1 << (q->len - 1);
+	for (j = 0; j < lb; j++) {
+		guint64 eq = q->peq[(guchar) b[j]];
+		guint64 xv = eq | mv;
+		guint64 xh = (((eq & pv) + pv) ^ pv) | eq;
+		guint64 ph = mv | ~(xh | pv);
+		guint64 mh = pv & xh;
+
+		if (ph & last) {
+			score++;
+		} else if (mh & last) {
+			score--;
+		}
+		/* each of the remaining bytes lowers it by one at most */
+		if (score > k + (lb - j - 1))
+			return k + 1;
+		ph = (ph << 1) | 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+	}
+	return score;
+}
+
+/* The same for longer queries, whose columns take several words, as in
+ * Hyyrö's variant: the change of the last row of a word, +1, 0 or -1, is
+ * carried into the first row of the next one, like the top row of the
+ * matrix is +1. The bits of the last word past the query do not matter,
+ * since nothing is carried downwards from them. */
+static guint
+distance_words (TmQuery *q, const char *b, guint lb, guint k)
+{
+	guint64 *pv = q->pv, *mv = q->mv;
+	guint64 last = (guint64) 1 << ((q->len - 1) % 64);
+	guint score = q->len, j, w;
+
+	for (w = 0; w < q->words; w++) {
+		pv[w] = ~(guint64) 0;
+		mv[w] = 0;
+	}
+	for (j = 0; j < lb; j++) {
+		const guint64 *eqs = q->peq + (guchar) b[j] * q->words;
+		int carry = 1;
+
+		for (w = 0; w < q->words; w++) {
+			guint64 in_minus = carry < 0, in_plus = carry > 0;
+			guint64 eq = eqs[w] | in_minus;
+			guint64 xv = eqs[w] | mv[w];
+			guint64 xh = (((eq & pv[w]) + pv[w]) ^ pv[w]) | eq;
+			guint64 ph = mv[w] | ~(xh | pv[w]);
+			guint64 mh = pv[w] & xh;
+
+			if (w + 1 < q->words) {
+				carry = (int) (ph >> 63) - (int) (mh >> 63);
+			} else if (ph & last) {
+				score++;
+			} else if (mh & last) {
+				score--;
+			}
+			ph = (ph << 1) | in_plus;
+			mh = (mh << 1) | in_minus;
+			pv[w] = mh | ~(xv | ph);
+			mv[w] = ph & xv;
+		}
+		if (score > k + (lb - j - 1))
+			return k + 1;
+	}
+	return score;
+}
+
+static guint
+query_distance (TmQuery *q, const char *b, guint lb, guint k)
+{
+	if (q->len <= 64)
+		return distance_bits (q, b, lb, k);
+	return distance_words (q, b, lb, k);
+}
+
+/* The distance is at least the difference of the lengths, and than what
+ * the histograms give, which are both much cheaper to work out. */
+static guint
+tm_distance (PoMemory *tm, TmQuery *q, guint32 i, guint k)
+{
+	TmEntry *e = &g_array_index (tm->entries, TmEntry, i);
+
+	if (q->len > e->len ? q->len - e->len > k : e->len - q->len > k)
+		return k + 1;
+	if (histogram_distance (q->hist, tm->hists + HIST_SIZE * i) > k)
+		return k + 1;
+	return query_distance (q, e->id, e->len, k);
+}
+
+/* The biggest distance which keeps the similarity of strings, the longer
+ * of which has len bytes, at least min. */
+static guint
+max_distance (double min, guint len)
+{
+	return (guint) ((1 - min) * len + EPSILON);
+}
+
+/* The biggest distance which makes the similarity bigger than better. */
+static guint
+better_distance (double better, guint len)
+{
+	double d = (1 - better) * len;
+	guint k = (guint) d;
+
+	return k > 0 && d - k < EPSILON ? k - 1 : k;
+}
+
+static double
+similarity (guint distance, guint la, guint lb)
+{
+	guint len = MAX (la, lb);
+
+	return len == 0 ? 1 : 1 - (double) distance / len;
+}
+
+static double
+strings_similarity (const char *a, const char *b)
+{
+	TmQuery q;
+	guint lb = strlen (b), d;
+
+	tm_query_init (&q, a, strlen (a));
+	d = query_distance (&q, b, lb, MAX (q.len, lb));
+	tm_query_clear (&q);
+	return similarity (d, q.len, lb);
+}
+
+/* -- looking up -- */
+
+#define NO_ENTRY G_MAXUINT32
+
+/* Once better is set, only more similar entries are of interest, or equally
+ * similar ones remembered before best: the first of those is taken,
+ * whichever way they are found. */
+typedef struct {
+	double min;
+	gboolean better;
+	guint32 best, best_order;
+	int forms;
+} TmSearch;
+
+/* The biggest distance which would make an entry the best one, or -1. */
+static gint
+tm_search_distance (TmSearch *search, guint32 order, guint len)
+{
+	if (!search->better || (search->best != NO_ENTRY && order < search->best_order))
+		return max_distance (search->min, len);
+	if (search->min >= 1 - EPSILON)
+		return -1;
+	return better_distance (search->min, len);
+}
+
+static void
+tm_try (PoMemory *tm, TmQuery *q, TmSearch *search, guint32 i)
+{
+	TmEntry *e = &g_array_index (tm->entries, TmEntry, i);
+	gint k;
+	guint d;
+
+	if (e->forms != search->forms)
+		return;
+	k = tm_search_distance (search, e->order, MAX (q->len, e->len));
+	if (k < 0 || (d = tm_distance (tm, q, i, k)) > (guint) k)
+		return;
+	search->min = similarity (d, q->len, e->len);
+	search->better = TRUE;
+	search->best = i;
+	search->best_order = e->order;
+}
+
+/* Whether the sorted list holds x. */
+static gboolean
+postings_find (const guint32 *list, guint n, guint32 x)
+{
+	guint lo = 0, hi = n;
+
+	while (lo < hi) {
+		guint mid = (lo + hi) / 2;
+
+		if (list[mid] < x) {
+			lo = mid + 1;
+		} else if (list[mid] > x) {
+			hi = mid;
+		} else {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static int
+compare_guint64 (const void *a, const void *b)
+{
+	guint64 x = *(const guint64 *) a, y = *(const guint64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Puts the rarest buckets first. */
+static void
+tm_sort_buckets (PoMemory *tm, guint32 *buckets, guint n)
+{
+	guint64 *keys = g_new (guint64, n);
+	guint i;
+
+	for (i = 0; i < n; i++) {
+		guint64 size = tm->starts[buckets[i] + 1] - tm->starts[buckets[i]];
+
+		keys[i] = size << 32 | buckets[i];
+	}
+	qsort (keys, n, sizeof *keys, compare_guint64);
+	for (i = 0; i < n; i++) {
+		buckets[i] = (guint32) keys[i];
+	}
+	g_free (keys);
+}
+
+static void
+tm_search_lengths (PoMemory *tm, TmQuery *q, TmSearch *search, guint min_len, guint max_len)
+{
+	TmEntry *entries = (TmEntry *) tm->entries->data;
+	guint len;
+	guint32 i;
+
+	max_len = MIN (max_len, tm->max_len);
+	for (len = min_len; len <= max_len; len++) {
+		/* a quick look first, at the biggest distance which might do */
+		guint k = max_distance (search->min, MAX (q->len, len));
+
+		for (i = tm->length_starts[len]; i < tm->length_starts[len + 1]; i++) {
+			if (entries[i].forms != search->forms ||
+			    histogram_distance (q->hist, tm->hists + HIST_SIZE * i) > k)
+				continue;
+			tm_try (tm, q, search, i);
+			k = max_distance (search->min, MAX (q->len, len));
+		}
+	}
+}
+
+static void
+tm_search_index (PoMemory *tm, TmQuery *q, TmSearch *search, guint32 *buckets, guint n_buckets, guint k_max, guint min_len, guint max_len)
+{
+	TmEntry *entries = (TmEntry *) tm->entries->data;
+	guint n_prefix = 3 * k_max + 1, i, j;
+	guint32 lookup;
+
+	if (++tm->lookups == 0) {
+		memset (tm->seen, 0, sizeof (guint32) * tm->entries->len);
+		tm->lookups = 1;
+	}
+	lookup = tm->lookups;
+	g_array_set_size (tm->candidates, 0);
+	for (i = 0; i < n_prefix; i++) {
+		guint32 *p = tm->postings + tm->starts[buckets[i]];
+		guint32 *end = tm->postings + tm->starts[buckets[i] + 1];
+
+		for (; p < end; p++) {
+			TmEntry *e = &entries[*p];
+
+			if (tm->seen[*p] == lookup) {
+				tm->hits[*p]++;
+			} else if (e->len >= min_len && e->len <= max_len && e->forms == search->forms) {
+				tm->seen[*p] = lookup;
+				tm->hits[*p] = 1;
+				g_array_append_val (tm->candidates, *p);
+			}
+		}
+	}
+
+	for (j = 0; j < tm->candidates->len; j++) {
+		guint32 c = g_array_index (tm->candidates, guint32, j);
+		guint len = MAX (q->len, entries[c].len);
+		gint k = tm_search_distance (search, entries[c].order, len);
+		guint hits = tm->hits[c];
+		gint need = (gint) n_buckets - 3 * k;
+
+		if (k < 0)
+			continue;
+		/* the common trigrams are only looked up while they matter */
+		for (i = n_prefix; (gint) hits < need && i < n_buckets; i++) {
+			if ((gint) (hits + n_buckets - i) < need)
+				break;
+			if (postings_find (tm->postings + tm->starts[buckets[i]],
+			                   tm->starts[buckets[i] + 1] - tm->starts[buckets[i]], c))
+				hits++;
+		}
+		if ((gint) hits >= need)
+			tm_try (tm, q, search, c);
+	}
+}
+
+/* Whether the lists of the rarest buckets, which tm_search_index() goes
+ * through, are shorter than the list of all the msgids of a suitable length.
+ * They are not when the msgids are made of few different words. */
+static gboolean
+tm_index_pays (PoMemory *tm, guint32 *buckets, guint n_buckets, guint k_max, guint min_len, guint max_len)
+{
+	guint64 postings = 0;
+	guint i;
+
+	if (n_buckets <= 3 * k_max || min_len > max_len)
+		return FALSE;
+	for (i = 0; i <= 3 * k_max; i++) {
+		postings += tm->starts[buckets[i] + 1] - tm->starts[buckets[i]];
+	}
+	return postings < tm->length_starts[max_len + 1] - tm->length_starts[min_len];
+}
+
+/* With better, the similarity has to be bigger than min_similarity. */
+static PoEntry *
+tm_lookup (PoMemory *tm, PoEntry *po, double min_similarity, gboolean better, double *similarity_ret)
+{
+	TmSearch search;
+	TmQuery query, *q = &query;
+	guint32 *buckets;
+	guint la, n_buckets, k_max, min_len, max_len;
+	double lo, hi;
+
+	if (tm->entries->len == 0)
+		return NULL;
+	if (tm->starts == NULL)
+		tm_index (tm);
+	if (min_similarity < EPSILON)
+		min_similarity = EPSILON;
+	if (min_similarity > 1)
+		min_similarity = 1;
+	search.min = min_similarity;
+	search.better = better;
+	search.best = NO_ENTRY;
+	search.forms = po->str != NULL ? 0 : po->n_msgstrxs;
+
+	la = strlen (po->id->str);
+	tm_query_init (q, po->id->str, la);
+	/* the distance is at least the difference of the lengths */
+	lo = la * min_similarity - EPSILON;
+	hi = la / min_similarity + EPSILON;
+	min_len = lo > 0 ? (guint) lo + ((guint) lo < lo) : 0;
+	max_len = hi < tm->max_len ? (guint) hi : tm->max_len;
+	k_max = max_distance (min_similarity, MAX (la, max_len));
+
+	buckets = g_new (guint32, la + 2);
+	n_buckets = tm_buckets (tm, q->s, la, buckets);
+	tm_sort_buckets (tm, buckets, n_buckets);
+	if (tm_index_pays (tm, buckets, n_buckets, k_max, min_len, max_len)) {
+		tm_search_index (tm, q, &search, buckets, n_buckets, k_max, min_len, max_len);
+	} else {
+		tm_search_lengths (tm, q, &search, min_len, max_len);
+	}
+	g_free (buckets);
+	tm_query_clear (q);
+
+	if (search.best == NO_ENTRY)
+		return NULL;
+	if (similarity_ret != NULL)
+		*similarity_ret = search.min;
+	return g_array_index (tm->entries, TmEntry, search.best).po;
+}
+
+PoEntry *
+po_memory_lookup (PoMemory *tm, PoEntry *po, double min_similarity, double *similarity)
+{
+	return tm_lookup (tm, po, min_similarity, FALSE, similarity);
+}
+
+/* -- suggesting -- */
+
+static gboolean
+entry_untranslated (PoEntry *po)
+{
+	int i;
+
+	if (po->str != NULL)
+		return po->str->str[0] == '\0';
+	for (i = 0; i < po->n_msgstrxs; i++) {
+		if (po->msgstrxs[i].str->str[0] != '\0')
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/* The translation is shared, the caller makes sure that it stays around. */
+static void
+suggest (PoArena *arena, PoEntry *po, PoEntry *from)
+{
+	if (po->str != NULL) {
+		po->str = from->str;
+	} else {
+		po->msgstrxs = from->msgstrxs;
+	}
+	po->previous.ctx = from->ctx;
+	po->previous.id = from->id;
+	po->previous.id_plural = from->id_plural;
+	if (!(po->flags & PO_FUZZY)) {
+		char **lines = po_arena_new_struct (arena, char *, po->comments.spec.n + 1);
+
+		if (po->comments.spec.n == 0) {
+			lines[0] = " fuzzy";
+		} else {
+			memcpy (lines, po->comments.spec.lines, sizeof (char *) * po->comments.spec.n);
+			lines[0] = po_arena_alloc (arena, strlen (lines[0]) + 8);
+			strcpy (lines[0], " fuzzy,");
+			strcat (lines[0], po->comments.spec.lines[0]);
+		}
+		po->comments.spec.lines = lines;
+		po->comments.spec.n = MAX (po->comments.spec.n, 1);
+	}
+	po->flags |= PO_FUZZY | PO_TRANSLATED;
+}
+
+int
+po_memory_suggest (PoMemory *tm, PoFile *pof, double min_similarity)
+{
+	PoEntry *po = (PoEntry *) pof->entries->data, *end = po + pof->entries->len;
+	int n = 0;
+
+	for (; po < end; po++) {
+		double min = min_similarity;
+		gboolean better = FALSE;
+		PoEntry *from;
+
+		if (po->flags & PO_HEADER)
+			continue;
+		if (!entry_untranslated (po)) {
+			/* a fuzzy translation is kept, unless the suggestion is
+			 * for a more similar msgid than it was made for */
+			if (!(po->flags & PO_FUZZY) || po->previous.id == NULL)
+				continue;
+			min = strings_similarity (po->previous.id->str, po->id->str);
+			better = min >= min_similarity;
+			min = MAX (min, min_similarity);
+		}
+		if ((from = tm_lookup (tm, po, min, better, NULL)) != NULL) {
+			suggest (pof->arena, po, from);
+			n++;
+		}
+	}
+	return n;
+}
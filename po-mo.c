@@ -0,0 +1,293 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include "po-gram.h"
+#include "i18n.h"
+
+/* The binary format read by gettext, as written by msgfmt: a header, the
+ * tables of the lengths and offsets of the original strings (sorted) and
+ * of their translations, a hash table of the original strings, and then
+ * the strings themselves, each followed by a NUL.
+ */
+#define MO_MAGIC 0x950412de
+
+typedef struct {
+	guint32 magic, revision, n_strings;
+	guint32 orig_offset, trans_offset;
+	guint32 hash_size, hash_offset;
+} MoHeader;
+
+typedef struct {
+	const char *key;        /* msgctxt "\004" msgid [ "\0" msgid_plural ] */
+	guint32 key_len;
+	const char *trans;      /* the msgstrs, separated by NULs */
+	guint32 trans_len;
+	int order;              /* in the po file, for telling duplicates */
+} MoMessage;
+
+/* Appends the string, with C escape sequences replaced. */
+static void
+mo_unescape (GString *out, StringBlock *block)
+{
+	const char *s = block->str;
+
+	while (*s != '\0') {
+		const char *bs = strchr (s, '\\');
+		int c, i;
+
+		if (bs == NULL) {
+			g_string_append (out, s);
+			break;
+		}
+		g_string_append_len (out, s, bs - s);
+		s = bs + 1;
+		switch (*s) {
+			case 'n': c = '\n'; s++; break;
+			case 't': c = '\t'; s++; break;
+			case 'r': c = '\r'; s++; break;
+			case 'a': c = '\a'; s++; break;
+			case 'b': c = '\b'; s++; break;
+			case 'f': c = '\f'; s++; break;
+			case 'v': c = '\v'; s++; break;
+			case 'x':
+				for (c = 0, s++; g_ascii_isxdigit (*s); s++) {
+					c = c * 16 + g_ascii_xdigit_value (*s);
+				}
+				break;
+			case '0': case '1': case '2': case '3':
+			case '4': case '5': case '6': case '7':
+				for (c = 0, i = 0; i < 3 && *s >= '0' && *s <= '7'; i++, s++) {
+					c = c * 8 + (*s - '0');
+				}
+				break;
+			case '\0':
+				c = '\\';
+				break;
+			default:
+				c = *s++;
+		}
+		g_string_append_c (out, c);
+	}
+}
+
+/* Empty translations are not written, like those of fuzzy entries
+ * other than the header. */
+static void
+mo_add_message (GString *strings, GArray *messages, PoEntry *po, int order)
+{
+	MoMessage m;
+	gsize key, trans;
+	int i;
+
+	if (po->flags & PO_OBSOLETE)
+		return;
+	if ((po->flags & PO_FUZZY) && !(po->flags & PO_HEADER))
+		return;
+	key = strings->len;
+	if (po->ctx != NULL) {
+		mo_unescape (strings, po->ctx);
+		g_string_append_c (strings, '\004');
+	}
+	mo_unescape (strings, po->id);
+	if (po->id_plural != NULL) {
+		g_string_append_c (strings, '\0');
+		mo_unescape (strings, po->id_plural);
+	}
+	m.key_len = strings->len - key;
+	g_string_append_c (strings, '\0');
+	trans = strings->len;
+	if (po->str != NULL) {
+		mo_unescape (strings, po->str);
+	} else {
+		for (i = 0; i < po->n_msgstrxs; i++) {
+			if (i > 0)
+				g_string_append_c (strings, '\0');
+			mo_unescape (strings, po->msgstrxs[i].str);
+		}
+	}
+	m.trans_len = strings->len - trans;
+	if (strings->str[trans] == '\0') {
+		/* as far as gettext is concerned, the first form tells */
+		g_string_truncate (strings, key);
+		return;
+	}
+	g_string_append_c (strings, '\0');
+	/* offsets for now, as the string grows */
+	m.key = GSIZE_TO_POINTER (key);
+	m.trans = GSIZE_TO_POINTER (trans);
+	m.order = order;
+	g_array_append_val (messages, m);
+}
+
+static int
+mo_message_cmp (gconstpointer a, gconstpointer b)
+{
+	const MoMessage *ma = a, *mb = b;
+	int ret = strcmp (ma->key, mb->key);
+
+	return ret != 0 ? ret : ma->order - mb->order;
+}
+
+/* The hash function of gettext. */
+static guint32
+mo_hash (const char *s)
+{
+	guint32 h = 0, g;
+
+	for (; *s != '\0'; s++) {
+		h = (h << 4) + (guchar) *s;
+		if ((g = h & 0xf0000000) != 0) {
+			h ^= g >> 24;
+			h ^= g;
+		}
+	}
+	return h;
+}
+
+static guint32
+mo_hash_size (guint32 n)
+{
+	guint32 size = n * 4 / 3, d;
+
+	if (size < 3)
+		return 3;
+	for (size |= 1; ; size += 2) {
+		for (d = 3; d * d <= size && size % d != 0; d += 2)
+			;
+		if (d * d > size)
+			return size;
+	}
+}
+
+/* Lookups probe with a step depending on the hash, like gettext does. */
+static guint32 *
+mo_hash_table (MoMessage *messages, guint32 n, guint32 size)
+{
+	guint32 *table = g_new0 (guint32, size), i;
+
+	for (i = 0; i < n; i++) {
+		guint32 h = mo_hash (messages[i].key);
+		guint32 idx = h % size, incr = 1 + h % (size - 2);
+
+		while (table[idx] != 0) {
+			idx = idx >= size - incr ? idx - (size - incr) : idx + incr;
+		}
+		table[idx] = i + 1;
+	}
+	return table;
+}
+
+gboolean
+po_write_mo (PoFile *pof, const char *fn, GError **error)
+{
+	PoEntry *po = (PoEntry *) pof->entries->data, *end = po + pof->entries->len;
+	GString *strings;
+	GArray *messages;
+	MoMessage *m;
+	MoHeader hdr;
+	guint32 *offsets, *hash, n, i, j, offset;
+	char *tmp_fn = NULL;
+	struct stat st;
+	FILE *out;
+	gboolean ok;
+	int fd = -1;
+
+	/* a regular file is replaced only once the new one is complete, so
+	 * that a failed run leaves the old one alone */
+	if (strcmp (fn, "-") == 0) {
+		out = stdout;
+	} else if (stat (fn, &st) == 0 && !S_ISREG (st.st_mode)) {
+		out = fopen (fn, "wb");
+	} else {
+		tmp_fn = g_strconcat (fn, ".XXXXXX", NULL);
+		if ((fd = g_mkstemp_full (tmp_fn, O_WRONLY, 0666)) < 0) {
+			out = NULL;
+		} else if ((out = fdopen (fd, "wb")) == NULL) {
+			close (fd);
+			unlink (tmp_fn);
+		}
+	}
+	if (out == NULL) {
+		g_set_error (error, PO_ERROR, PO_ERROR_WRITE,
+		             _("Can't open output file %s: %s"), fn, g_strerror (errno));
+		g_free (tmp_fn);
+		return FALSE;
+	}
+	strings = g_string_sized_new (64 * 1024);
+	messages = g_array_new (FALSE, FALSE, sizeof (MoMessage));
+	for (i = 0; po < end; po++, i++) {
+		mo_add_message (strings, messages, po, i);
+	}
+	m = (MoMessage *) messages->data;
+	for (i = 0; i < messages->len; i++) {
+		m[i].key = strings->str + GPOINTER_TO_SIZE (m[i].key);
+		m[i].trans = strings->str + GPOINTER_TO_SIZE (m[i].trans);
+	}
+	/* a msgid given twice is translated by the last entry */
+	g_array_sort (messages, mo_message_cmp);
+	for (i = 0, n = 0; i < messages->len; i++) {
+		if (i + 1 < messages->len && strcmp (m[i].key, m[i + 1].key) == 0)
+			continue;
+		m[n++] = m[i];
+	}
+
+	hdr.magic = MO_MAGIC;
+	hdr.revision = 0;
+	hdr.n_strings = n;
+	hdr.orig_offset = sizeof hdr;
+	hdr.trans_offset = hdr.orig_offset + n * 8;
+	hdr.hash_size = mo_hash_size (n);
+	hdr.hash_offset = hdr.trans_offset + n * 8;
+	hash = mo_hash_table (m, n, hdr.hash_size);
+	offsets = g_new (guint32, n * 4);
+	offset = hdr.hash_offset + hdr.hash_size * 4;
+	for (i = 0; i < n; i++) {
+		offsets[i * 2] = m[i].key_len;
+		offsets[i * 2 + 1] = offset;
+		offset += m[i].key_len + 1;
+	}
+	for (i = 0, j = n * 2; i < n; i++) {
+		offsets[j + i * 2] = m[i].trans_len;
+		offsets[j + i * 2 + 1] = offset;
+		offset += m[i].trans_len + 1;
+	}
+
+	ok = fwrite (&hdr, sizeof hdr, 1, out) == 1 &&
+	     (n == 0 || fwrite (offsets, n * 16, 1, out) == 1) &&
+	     fwrite (hash, hdr.hash_size * 4, 1, out) == 1;
+	for (i = 0; ok && i < n; i++) {
+		ok = fwrite (m[i].key, m[i].key_len + 1, 1, out) == 1;
+	}
+	for (i = 0; ok && i < n; i++) {
+		ok = fwrite (m[i].trans, m[i].trans_len + 1, 1, out) == 1;
+	}
+	ok = (out == stdout ? fflush (out) : fclose (out)) == 0 && ok;
+	if (ok && tmp_fn != NULL)
+		ok = rename (tmp_fn, fn) == 0;
+	if (ok) {
+		po_count_written (offset);
+	} else {
+		g_set_error (error, PO_ERROR, PO_ERROR_WRITE,
+		             _("Writing %s failed: %s"), fn, g_strerror (errno));
+		if (tmp_fn != NULL)
+			unlink (tmp_fn);
+	}
+	g_free (tmp_fn);
+	g_free (offsets);
+	g_free (hash);
+	g_array_free (messages, TRUE);
+	g_string_free (strings, TRUE);
+	return ok;
+}
@@ -0,0 +1,134 @@
+/*
+ * potool is a program aiding editing of po files
+ * Copyright (C) 2000-2019 Marcin Owsiany <porridge@debian.org>
+ *
+ * see LICENSE for licensing info
+ */
+#include <string.h>
+#include <glib.h>
+#include "po-gram.h"
+
+/* Strings are kept once for their text, and blocks once for their text and
+ * the lengths of their lines, so that the original wrapping survives. */
+struct _PoPool {
+	PoArena *arena;
+	GHashTable *strings;
+	GHashTable *blocks;
+};
+
+static guint
+block_hash (gconstpointer key)
+{
+	const StringBlock *block = key;
+
+	return g_str_hash (block->str) * 31 + block->num_lines;
+}
+
+static gboolean
+block_equal (gconstpointer a, gconstpointer b)
+{
+	const StringBlock *x = a, *y = b;
+
+	return x->num_lines == y->num_lines &&
+	       memcmp (x->line_lengths, y->line_lengths, sizeof (int) * x->num_lines) == 0 &&
+	       strcmp (x->str, y->str) == 0;
+}
+
+PoPool *
+po_pool_new (void)
+{
+	PoPool *pool = g_new (PoPool, 1);
+
+	pool->arena = po_arena_new ();
+	pool->strings = g_hash_table_new (g_str_hash, g_str_equal);
+	pool->blocks = g_hash_table_new (block_hash, block_equal);
+	return pool;
+}
+
+void
+po_pool_free (PoPool *pool)
+{
+	if (pool == NULL)
+		return;
+	g_hash_table_destroy (pool->strings);
+	g_hash_table_destroy (pool->blocks);
+	po_arena_free (pool->arena);
+	g_free (pool);
+}
+
+guint
+po_pool_size (PoPool *pool)
+{
+	return g_hash_table_size (pool->strings) + g_hash_table_size (pool->blocks);
+}
+
+static char *
+pool_string (PoPool *pool, const char *s)
+{
+	char *ret = g_hash_table_lookup (pool->strings, s);
+
+	if (ret == NULL) {
+		ret = po_arena_strdup (pool->arena, s);
+		g_hash_table_insert (pool->strings, ret, ret);
+	}
+	return ret;
+}
+
+static StringBlock *
+pool_block (PoPool *pool, StringBlock *block)
+{
+	StringBlock *ret;
+
+	if (block == NULL)
+		return NULL;
+	if ((ret = g_hash_table_lookup (pool->blocks, block)) == NULL) {
+		ret = stringblock_dup (pool->arena, block);
+		g_hash_table_insert (pool->blocks, ret, ret);
+	}
+	return ret;
+}
+
+static void
+intern_entry (PoPool *pool, PoArena *arena, PoEntry *po)
+{
+	char **pos = po->comments.pos.lines;
+	int i;
+
+	po->ctx = pool_block (pool, po->ctx);
+	po->id = pool_block (pool, po->id);
+	po->id_plural = pool_block (pool, po->id_plural);
+	po->comments.pos.lines = po_arena_new_struct (arena, char *, po->comments.pos.n);
+	for (i = 0; i < po->comments.pos.n; i++) {
+		po->comments.pos.lines[i] = pool_string (pool, pos[i]);
+	}
+
+	/* the rest is different in every catalog */
+	po->comments.std = po_lines_dup (arena, po->comments.std);
+	po->comments.res = po_lines_dup (arena, po->comments.res);
+	po->comments.spec = po_lines_dup (arena, po->comments.spec);
+	po->previous.ctx = stringblock_dup (arena, po->previous.ctx);
+	po->previous.id = stringblock_dup (arena, po->previous.id);
+	po->previous.id_plural = stringblock_dup (arena, po->previous.id_plural);
+	po->str = stringblock_dup (arena, po->str);
+	po->msgstrxs = po_msgstrxs_dup (arena, po->msgstrxs, po->n_msgstrxs);
+}
+
+void
+po_intern (PoPool *pool, PoFile *pof)
+{
+	PoArena *arena = po_arena_new ();
+	guint i;
+
+	for (i = 0; i < pof->entries->len; i++) {
+		intern_entry (pool, arena, &g_array_index (pof->entries, PoEntry, i));
+	}
+	for (i = 0; i < pof->obsolete_entries->len; i++) {
+		intern_entry (pool, arena, &g_array_index (pof->obsolete_entries, PoEntry, i));
+	}
+	po_arena_free (pof->arena);
+	po_buffer_free (pof->buffer);
+	g_slist_free_full (pof->adopted_buffers, (GDestroyNotify) po_buffer_free);
+	pof->arena = arena;
+	pof->buffer = NULL;
+	pof->adopted_buffers = NULL;
+}
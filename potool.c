@@ -13,15 +13,20 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include <glib-unix.h>
 #include "i18n.h"
 #include "common.h"
-#include "po-gram.h"
-
-#define RMARGIN 80
-
-
-typedef gboolean po_filter_func (PoEntry *);
+#include "libpotool.h"
 
 void
 po_error(const gchar *format, ...)
@@ -33,609 +38,1459 @@ po_error(const gchar *format, ...)
 	exit(1);
 }
 
-void
-stringblock_free(StringBlock *block)
+/* The msgid is shared, not copied. */
+static void
+po_copy_msgid (PoFile *pof)
 {
-	if (block == NULL)
-		return;
-	g_free (block->str);
-	g_free (block->line_lengths);
-	g_free (block);
-}
+	PoEntry *po = (PoEntry *) pof->entries->data, *end = po + pof->entries->len;
+
+	for (; po < end; po++) {
+		if (po->str) {
+			po->str = po->id;
+		} else {
+			MsgStrX *m = po_arena_new_struct (pof->arena, MsgStrX, 1);
+			m->n = 0;
+			m->str = po->id;
+			po->msgstrxs = m;
+			po->n_msgstrxs = 1;
+		}
+	}
 
-void
-msgstrx_free(MsgStrX *msgstrx)
-{
-	stringblock_free (msgstrx->str);
-	g_free (msgstrx);
 }
 
-StringBlock*
-stringblock_dup(StringBlock *block)
+/* --- */
+
+int potool_fprintf(FILE *out, char *format, ...)
 {
-	if (block == NULL)
-		return NULL;
-	StringBlock *ret = g_new(StringBlock, 1);
-	*ret = *block;
-	ret->str = g_strdup (ret->str);
-	ret->line_lengths = malloc(sizeof(int) * ret->num_lines);
-	memcpy(ret->line_lengths, block->line_lengths, sizeof(int) * ret->num_lines);
+	va_list ap;
+	int ret;
+	va_start(ap, format);
+	ret = vfprintf(out, format, ap);
+	if (ret < 0)
+		po_error(_("printf() failed with code %d: %s"), ret, strerror(errno));
+	va_end(ap);
 	return ret;
 }
 
-void
-po_list_str_dup(GSList *list)
+/* --- profiling --- */
+
+/* With -P, the phases of the work are timed, taking turns: the time a phase
+ * spends calling into another one is counted in the other one only. While
+ * streaming, reading and writing take turns for every entry. The CPU time
+ * is that of the whole process, including the threads working meanwhile. */
+typedef enum {
+	PHASE_OTHER,
+	PHASE_READ,
+	PHASE_RECODE,
+	PHASE_STATS,
+	PHASE_MERGE,
+	PHASE_SUGGEST,
+	PHASE_WRITE,
+	PHASE_COMPILE,
+	N_PHASES
+} PotoolPhase;
+
+static const char *phase_names[N_PHASES] = {
+	"other", "read", "recode", "stats", "merge", "suggest", "write", "compile"
+};
+
+typedef struct {
+	gboolean json;
+	PotoolPhase phase;              /* the one being timed */
+	gint64 wall_start, cpu_start;   /* of its current turn */
+	gint64 wall[N_PHASES], cpu[N_PHASES];   /* microseconds */
+	gboolean used[N_PHASES];
+} PotoolProfile;
+
+static PotoolProfile *profile;      /* NULL without -P */
+
+static gint64
+potool_cpu_time (void)
 {
-	GSList *l;
-	for (l = list; l != NULL; l = l->next) {
-		char *s = l->data;
-		l->data = g_strdup (s);
-	}
-}
+	struct timespec ts;
 
+	clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * (gint64) 1000000 + ts.tv_nsec / 1000;
+}
 
-void
-po_list_stringblock_dup(GSList *list)
+static void
+potool_profile_start (const char *format)
 {
-	GSList *l;
-	for (l = list; l != NULL; l = l->next) {
-		StringBlock *s = l->data;
-		l->data = stringblock_dup (s);
-	}
+	if (strcmp (format, "json") != 0 && strcmp (format, "text") != 0)
+		po_error (_("Unknown profile format \"%s\"!"), format);
+	profile = g_new0 (PotoolProfile, 1);
+	profile->json = strcmp (format, "json") == 0;
+	profile->phase = PHASE_OTHER;
+	profile->used[PHASE_OTHER] = TRUE;
+	profile->wall_start = g_get_monotonic_time ();
+	profile->cpu_start = potool_cpu_time ();
+	po_counters_enable ();
 }
 
-void
-po_list_msgstrx_dup(GSList *list)
+/* Starts timing phase instead of the current one, which is returned so
+ * that the caller can go back to it. */
+static PotoolPhase
+potool_phase (PotoolPhase phase)
 {
-	GSList *l;
-	for (l = list; l != NULL; l = l->next) {
-		MsgStrX *s = l->data;
-		MsgStrX *n = g_new (MsgStrX, 1);
-		n->n = s->n;
-		n->str = stringblock_dup(s->str);
-		l->data = n;
-	}
+	PotoolPhase prev;
+	gint64 wall, cpu;
+
+	if (profile == NULL || phase == profile->phase)
+		return phase;
+	wall = g_get_monotonic_time ();
+	cpu = potool_cpu_time ();
+	prev = profile->phase;
+	profile->wall[prev] += wall - profile->wall_start;
+	profile->cpu[prev] += cpu - profile->cpu_start;
+	profile->phase = phase;
+	profile->used[phase] = TRUE;
+	profile->wall_start = wall;
+	profile->cpu_start = cpu;
+	return prev;
 }
 
-PoEntry *
-po_entry_copy (PoEntry *ret, PoEntry *po)
+/* Printed to the standard error, so as not to mix with the output. */
+static void
+potool_profile_print (void)
 {
-	if (ret == NULL)
-		ret = g_new (PoEntry, 1);
+	gint64 wall = 0, cpu = 0;
+	struct rusage ru;
+	PoCounters c;
+	int i;
 
-	ret->comments.std = g_slist_copy (po->comments.std);
-	po_list_str_dup(ret->comments.std);
-	ret->comments.pos = g_slist_copy (po->comments.pos);
-	po_list_str_dup(ret->comments.pos);
-	ret->comments.res = g_slist_copy (po->comments.res);
-	po_list_str_dup(ret->comments.res);
-	ret->comments.spec = g_slist_copy (po->comments.spec);
-	po_list_str_dup(ret->comments.spec);
+	if (profile == NULL)
+		return;
+	/* the last turn */
+	potool_phase (PHASE_OTHER);
+	profile->wall[PHASE_OTHER] += g_get_monotonic_time () - profile->wall_start;
+	profile->cpu[PHASE_OTHER] += potool_cpu_time () - profile->cpu_start;
+	po_counters_get (&c);
+	getrusage (RUSAGE_SELF, &ru);
+	for (i = 0; i < N_PHASES; i++) {
+		wall += profile->wall[i];
+		cpu += profile->cpu[i];
+	}
 
-	ret->previous.ctx = stringblock_dup (po->previous.ctx);
-	ret->previous.id = stringblock_dup (po->previous.id);
-	ret->previous.id_plural = stringblock_dup (po->previous.id_plural);
+	if (profile->json) {
+		fprintf (stderr, "{\"phases\": {");
+		for (i = 0; i < N_PHASES; i++) {
+			if (profile->used[i])
+				fprintf (stderr, "%s\"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}",
+				         i > 0 ? ", " : "", phase_names[i],
+				         profile->wall[i] / 1000.0, profile->cpu[i] / 1000.0);
+		}
+		fprintf (stderr, "}, \"wall_ms\": %.3f, \"cpu_ms\": %.3f", wall / 1000.0, cpu / 1000.0);
+		fprintf (stderr, ", \"tokens\": %" G_GUINT64_FORMAT, c.tokens);
+		fprintf (stderr, ", \"entries_parsed\": %" G_GUINT64_FORMAT, c.entries_parsed);
+		fprintf (stderr, ", \"entries_kept\": %" G_GUINT64_FORMAT, c.entries_kept);
+		fprintf (stderr, ", \"bytes_read\": %" G_GUINT64_FORMAT, c.bytes_read);
+		fprintf (stderr, ", \"bytes_written\": %" G_GUINT64_FORMAT, c.bytes_written);
+		fprintf (stderr, ", \"allocs\": %" G_GUINT64_FORMAT, c.allocs);
+		fprintf (stderr, ", \"alloc_bytes\": %" G_GUINT64_FORMAT, c.alloc_bytes);
+		fprintf (stderr, ", \"alloc_chunks\": %" G_GUINT64_FORMAT, c.alloc_chunks);
+		fprintf (stderr, ", \"peak_rss_kb\": %ld}\n", ru.ru_maxrss);
+		return;
+	}
+	fprintf (stderr, "%-10s %10s %10s\n", _("phase"), _("wall ms"), _("CPU ms"));
+	for (i = 0; i < N_PHASES; i++) {
+		if (profile->used[i])
+			fprintf (stderr, "%-10s %10.3f %10.3f\n", phase_names[i],
+			         profile->wall[i] / 1000.0, profile->cpu[i] / 1000.0);
+	}
+	fprintf (stderr, "%-10s %10.3f %10.3f\n", _("total"), wall / 1000.0, cpu / 1000.0);
+	fprintf (stderr, _("tokens: %" G_GUINT64_FORMAT "\n"), c.tokens);
+	fprintf (stderr, _("entries: %" G_GUINT64_FORMAT " parsed, %" G_GUINT64_FORMAT " kept\n"),
+	         c.entries_parsed, c.entries_kept);
+	fprintf (stderr, _("bytes: %" G_GUINT64_FORMAT " read, %" G_GUINT64_FORMAT " written\n"),
+	         c.bytes_read, c.bytes_written);
+	fprintf (stderr, _("allocations: %" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT " bytes in %" G_GUINT64_FORMAT " chunks\n"),
+	         c.allocs, c.alloc_bytes, c.alloc_chunks);
+	fprintf (stderr, _("peak RSS: %ld kB\n"), ru.ru_maxrss);
+}
 
-	ret->is_fuzzy = po->is_fuzzy;
-	ret->is_c_format = po->is_c_format;
+/* --- statistics --- */
 
-	ret->ctx = stringblock_dup (po->ctx);
-	ret->id = stringblock_dup (po->id);
-	ret->id_plural = stringblock_dup (po->id_plural);
-	ret->str = stringblock_dup (po->str);
+typedef enum {
+	NO_STATS,
+	COUNT_STATS,
+	FULL_STATS,
+	RAW_STATS
+} PoStatsModes;
+
+typedef struct {
+	int total, translated, fuzzy, untranslated, obsolete, plural;
+	long id_words, id_chars, str_words, str_chars;
+} PoStats;
+
+/* Counts words and characters of an escaped string. Escape sequences count
+ * as one character, and those for whitespace separate words. UTF-8
+ * continuation bytes are not counted. */
+static void
+po_count_text (const StringBlock *block, long *words, long *chars)
+{
+	const char *s;
+	gboolean in_word = FALSE;
 
-	ret->msgstrxs = g_slist_copy (po->msgstrxs);
-	po_list_msgstrx_dup(ret->msgstrxs);
+	if (block == NULL)
+		return;
+	for (s = block->str; *s != '\0'; ) {
+		gboolean space;
 
-	return ret;
+		if (*s == '\\' && s[1] != '\0') {
+			space = s[1] == 'n' || s[1] == 't' || s[1] == 'r';
+			s += 2;
+		} else {
+			space = g_ascii_isspace (*s);
+			s++;
+			while (((guchar) *s & 0xc0) == 0x80)
+				s++;
+		}
+		(*chars)++;
+		if (space) {
+			in_word = FALSE;
+		} else if (!in_word) {
+			in_word = TRUE;
+			(*words)++;
+		}
+	}
 }
 
-void
-po_entry_free_contents (PoEntry *po)
+static void
+po_stats_add (PoStats *st, PoEntry *po, gboolean is_obsolete)
 {
-	g_slist_free_custom (po->comments.std, g_free);
-	g_slist_free_custom (po->comments.pos, g_free);
-	g_slist_free_custom (po->comments.res, g_free);
-	g_slist_free_custom (po->comments.spec, g_free);
-	g_slist_free_custom (po->msgstrxs, msgstrx_free);
-	stringblock_free (po->previous.id);
-	stringblock_free (po->previous.id_plural);
-	stringblock_free (po->previous.ctx);
+	int i;
 
-	stringblock_free (po->id);
-	stringblock_free (po->id_plural);
-	stringblock_free (po->ctx);
-	stringblock_free (po->str);
+	if (is_obsolete) {
+		st->obsolete++;
+		return;
+	}
+	st->total++;
+	if (po->flags & PO_TRANSLATED) {
+		st->translated++;
+	} else {
+		st->untranslated++;
+	}
+	if (po->flags & PO_FUZZY)
+		st->fuzzy++;
+	if (po->id_plural)
+		st->plural++;
+	po_count_text (po->id, &st->id_words, &st->id_chars);
+	po_count_text (po->id_plural, &st->id_words, &st->id_chars);
+	po_count_text (po->str, &st->str_words, &st->str_chars);
+	for (i = 0; i < po->n_msgstrxs; i++) {
+		po_count_text (po->msgstrxs[i].str, &st->str_words, &st->str_chars);
+	}
 }
 
-void
-po_entry_free (PoEntry *po)
+static void
+po_stats_print (PoStats *st, PoStatsModes mode, FILE *out)
 {
-	po_entry_free_contents (po);
-	g_free (po);
+	switch (mode) {
+		case COUNT_STATS:
+			potool_fprintf (out, _("%d\n"), st->total);
+			break;
+		case RAW_STATS:
+			potool_fprintf (out, "%d %d %d %d %d %d %ld %ld %ld %ld\n",
+			                st->total, st->translated, st->fuzzy, st->untranslated,
+			                st->obsolete, st->plural, st->id_words, st->id_chars,
+			                st->str_words, st->str_chars);
+			break;
+		case FULL_STATS:
+			potool_fprintf (out, _("Entries:            %d\n"), st->total);
+			potool_fprintf (out, _("Translated:         %d (%d%%)\n"), st->translated,
+			                st->total > 0 ? st->translated * 100 / st->total : 0);
+			potool_fprintf (out, _("Fuzzy:              %d\n"), st->fuzzy);
+			potool_fprintf (out, _("Untranslated:       %d\n"), st->untranslated);
+			potool_fprintf (out, _("Obsolete:           %d\n"), st->obsolete);
+			potool_fprintf (out, _("With plural forms:  %d\n"), st->plural);
+			potool_fprintf (out, _("Msgid words:        %ld\n"), st->id_words);
+			potool_fprintf (out, _("Msgid characters:   %ld\n"), st->id_chars);
+			potool_fprintf (out, _("Msgstr words:       %ld\n"), st->str_words);
+			potool_fprintf (out, _("Msgstr characters:  %ld\n"), st->str_chars);
+			break;
+		default:
+			g_assert_not_reached ();
+	}
 }
 
-void
-po_free (PoFile *pof)
+/* An output given with -o. When several of them name the same file, they
+ * are written to it in turn, all but the first going to a temporary file
+ * until the input has been read. */
+typedef struct {
+	char *fn;
+	PoFilters filters;
+	po_write_modes mode;
+	FILE *out;
+	dev_t dev;                      /* of the file, once open */
+	ino_t ino;
+	int owner;                      /* the first sink with the same file */
+	int n_entries;
+	gboolean first_is_obsolete;
+	gboolean file_written;          /* in the owner, whether the file has entries */
+	PoWriter writer;
+} PoSink;
+
+/* Single file mode: every entry that passes the filters is written (or
+ * counted) as soon as it is parsed, and then forgotten. */
+typedef struct {
+	PoStatsModes stats_mode;
+	gboolean copy_msgid;
+	PoStats stats;
+	PoWriter writer;
+	GArray *sinks;                  /* if not empty, used instead of writer */
+	/* with -C, the charset of the header entry is needed, so the entries
+	 * are filtered here instead of by the parser */
+	PoFilters filters;
+	const char *charset;
+	PoRecoder *recoder;
+	PoArena *arena;                 /* for converted strings, one entry at a time */
+} PoStream;
+
+static void
+po_stream_recoder (PoStream *ps, PoEntry *po, gboolean is_obsolete)
 {
-	g_slist_free_custom (pof->entries, po_entry_free);
-	g_slist_free_custom (pof->obsolete_entries, po_entry_free);
-	g_free (pof);
+	GError *error = NULL;
+	char *from;
+
+	if (is_obsolete || !(po->flags & PO_HEADER) || (from = po_entry_charset (po)) == NULL)
+		po_error (_("No charset in the header entry, can't convert to %s"), ps->charset);
+	ps->recoder = po_recoder_new (from, ps->charset, &error);
+	g_free (from);
+	if (ps->recoder == NULL)
+		po_error ("%s\n", error->message);
+	ps->arena = po_arena_new ();
 }
 
-/* --- PoEntry filters --- */
+static void
+po_stream_entry (PoEntry *po, gboolean is_obsolete, gpointer data)
+{
+	PoStream *ps = data;
+	PotoolPhase prev;
+	MsgStrX m;
+
+	if (ps->charset != NULL && ps->recoder == NULL)
+		po_stream_recoder (ps, po, is_obsolete);
+	if (!po_entry_filter (po, ps->filters))
+		return;
+	if (ps->stats_mode != NO_STATS) {
+		prev = potool_phase (PHASE_STATS);
+		po_stats_add (&ps->stats, po, is_obsolete);
+		potool_phase (prev);
+		if (ps->sinks->len == 0)
+			return;
+	}
+	if (ps->recoder != NULL) {
+		GError *error = NULL;
+
+		prev = potool_phase (PHASE_RECODE);
+		po_arena_clear (ps->arena);
+		if (!po_recode_entry (ps->recoder, ps->arena, po, &error))
+			po_error (_("Converting to %s failed: %s"), ps->charset, error->message);
+		potool_phase (prev);
+	}
+	if (ps->copy_msgid && !is_obsolete) {
+		if (po->str) {
+			po->str = po->id;
+		} else {
+			m.n = 0;
+			m.str = po->id;
+			po->msgstrxs = &m;
+			po->n_msgstrxs = 1;
+		}
+	}
+	prev = potool_phase (PHASE_WRITE);
+	if (ps->sinks->len == 0) {
+		po_write_entry (&ps->writer, po, is_obsolete);
+	} else {
+		PoSink *sink = (PoSink *) ps->sinks->data, *end = sink + ps->sinks->len;
+
+		for (; sink < end; sink++) {
+			if (!po_entry_filter (po, sink->filters))
+				continue;
+			if (sink->n_entries++ == 0)
+				sink->first_is_obsolete = is_obsolete;
+			po_write_entry (&sink->writer, po, is_obsolete);
+		}
+	}
+	potool_phase (prev);
+}
 
-gint
-msgstrx_is_same_firstchar (gconstpointer a, gconstpointer b)
+static void
+potool_finish_write (PoWriter *pw)
 {
-	const MsgStrX *as = a, *bs = b;
-	return ! (as == bs ||
-	          (as && bs &&
-	           ((as->str == bs->str) ||
-	            (as->str && as->str->str &&
-	             bs->str && bs->str->str &&
-	             as->str->str[0] == bs->str->str[0]))));
+	po_writer_finish (pw);
+	if (pw->error != 0)
+		po_error (_("Writing output failed: %s"), g_strerror (pw->error));
 }
 
-static gboolean
-po_filter_translated (PoEntry *po)
+/* 0 if unknown */
+static PoFilters
+potool_find_filter (const char *arg)
 {
-	if (po->str && po->str->str)
-		return po->str->str[0] != '\0';
-	
-	/* With plural forms, only return true if ALL forms are translated. The
-	 * list is guaranteed to be non-empty by the grammar */
-	else {
-		int one_empty_line[] = { 0 };
-		StringBlock empty_block = { "", 1, one_empty_line };
-		MsgStrX empty = { &empty_block, 0 };
-		return NULL == g_slist_find_custom (po->msgstrxs, &empty, msgstrx_is_same_firstchar);
-	}
+	if (strcmp (arg, "f") == 0)
+		return FUZZY_FILTER;
+	if (strcmp (arg, "nf") == 0)
+		return NOT_FUZZY_FILTER;
+	if (strcmp (arg, "t") == 0)
+		return TRANSLATED_FILTER;
+	if (strcmp (arg, "nt") == 0)
+		return NOT_TRANSLATED_FILTER;
+	if (strcmp (arg, "nth") == 0)
+		return NOT_TRANSLATED_H_FILTER;
+	if (strcmp (arg, "o") == 0)
+		return OBSOLETE_FILTER;
+	if (strcmp (arg, "no") == 0)
+		return NOT_OBSOLETE_FILTER;
+	return 0;
 }
 
-static gboolean
-po_filter_not_translated (PoEntry *po)
+static PoFilters
+potool_filter (const char *arg)
 {
-	if (po->str && po->str->str)
-		return po->str->str[0] == '\0';
+	PoFilters filter = potool_find_filter (arg);
 
-	/* With plural forms, only return true if ANY forms are not translated.
-	 * The list is guaranteed to be non-empty by the grammar */
-	else {
-		int one_empty_line[] = { 0 };
-		StringBlock empty_block = { "", 1, one_empty_line };
-		MsgStrX empty = { &empty_block, 0 };
-		return NULL != g_slist_find_custom (po->msgstrxs, &empty, msgstrx_is_same_firstchar);
-	}
+	if (filter == 0)
+		po_error (_("Unknown filter \"%s\"!"), arg);
+	return filter;
 }
 
-static gboolean
-po_filter_not_translated_and_header (PoEntry *po)
+/* 0 if unknown */
+static po_write_modes
+potool_find_write_mode (const char *arg)
 {
-	if (po->id->str[0] == '\0')
-		return 1;
-	else
-		return po_filter_not_translated (po);
+	if (strcmp (arg, "ctxt") == 0)
+		return NO_CTX;
+	if (strcmp (arg, "id") == 0)
+		return NO_ID;
+	if (strcmp (arg, "str") == 0)
+		return NO_STR;
+	if (strcmp (arg, "cmt") == 0)
+		return NO_STD_COMMENT | NO_POS_COMMENT | NO_SPEC_COMMENT | NO_RES_COMMENT;
+	if (strcmp (arg, "ucmt") == 0)
+		return NO_STD_COMMENT;
+	if (strcmp (arg, "pcmt") == 0)
+		return NO_POS_COMMENT;
+	if (strcmp (arg, "scmt") == 0)
+		return NO_SPEC_COMMENT;
+	if (strcmp (arg, "dcmt") == 0)
+		return NO_RES_COMMENT;
+	if (strcmp (arg, "tr") == 0)
+		return NO_TRANSLATION;
+	if (strcmp (arg, "linf") == 0)
+		return NO_LINF;
+	return 0;
 }
 
-static gboolean
-po_filter_fuzzy (PoEntry *po)
+static po_write_modes
+potool_write_mode (const char *arg)
 {
-	return po->is_fuzzy;
+	po_write_modes mode = potool_find_write_mode (arg);
+
+	if (mode == 0)
+		po_error (_("Unknown parameter for -n option!"));
+	return mode;
 }
 
-static gboolean
-po_filter_not_fuzzy (PoEntry *po)
+/* Parses the argument of -o: a file name, optionally followed by a colon
+ * and -f and -n options separated by spaces or commas. */
+static void
+potool_add_sink (GArray *sinks, char *arg)
 {
-	return !po->is_fuzzy;
+	PoSink sink = { arg };
+	char *opts = strrchr (arg, ':');
+
+	if (opts != NULL) {
+		char **words, **w;
+
+		*opts++ = '\0';
+		words = g_strsplit_set (opts, " ,", 0);
+		for (w = words; *w != NULL; w++) {
+			if (**w == '\0')
+				continue;
+			if (strncmp (*w, "-f", 2) == 0) {
+				sink.filters |= potool_filter (*w + 2);
+			} else if (strncmp (*w, "-n", 2) == 0) {
+				sink.mode |= potool_write_mode (*w + 2);
+			} else {
+				po_error (_("Unknown output option \"%s\"!"), *w);
+			}
+		}
+		g_strfreev (words);
+	}
+	g_array_append_val (sinks, sink);
 }
 
-/* -- */
-
 static void
-po_apply_filter (PoFile *pof, po_filter_func *filter)
+potool_open_sinks (GArray *sinks, po_write_modes mode, gboolean preserve_wrapping)
 {
-	GSList *npo_list, *l;
-
-	for (npo_list = NULL, l = pof->entries; l != NULL; l = l->next) {
-		if (filter ((PoEntry *) l->data)) {
-			npo_list = g_slist_prepend (npo_list, l->data);
+	PoSink *sinks_data = (PoSink *) sinks->data;
+	int i, j;
+
+	for (i = 0; i < sinks->len; i++) {
+		PoSink *sink = &sinks_data[i];
+		gboolean is_stdout = strcmp (sink->fn, "-") == 0;
+		struct stat st;
+		/* names which differ may still be the same file, and the owners
+		 * of files are all open by now */
+		gboolean exists = is_stdout ? fstat (STDOUT_FILENO, &st) == 0 : stat (sink->fn, &st) == 0;
+
+		for (j = 0; j < i; j++) {
+			PoSink *other = &sinks_data[j];
+
+			if (other->owner != j)
+				continue;
+			if (exists ? other->dev == st.st_dev && other->ino == st.st_ino
+			           : strcmp (other->fn, sink->fn) == 0)
+				break;
+		}
+		sink->owner = j;
+		if (j < i) {
+			sink->out = tmpfile ();
+		} else if (is_stdout) {
+			sink->out = stdout;
 		} else {
-			po_entry_free (l->data);
+			sink->out = fopen (sink->fn, "w");
+		}
+		if (sink->out == NULL)
+			po_error (_("Can't open output file %s: %s"), sink->fn, strerror (errno));
+		sink->dev = 0;
+		sink->ino = 0;
+		if (j == i && fstat (fileno (sink->out), &st) == 0) {
+			sink->dev = st.st_dev;
+			sink->ino = st.st_ino;
 		}
+		po_writer_init (&sink->writer, sink->out, mode | sink->mode, preserve_wrapping);
 	}
-	g_slist_free (pof->entries);
-	pof->entries = g_slist_reverse (npo_list);
+}
 
-	for (npo_list = NULL, l = pof->obsolete_entries; l != NULL; l = l->next) {
-		if (filter ((PoEntry *) l->data)) {
-			npo_list = g_slist_prepend (npo_list, l->data);
-		} else {
-			po_entry_free (l->data);
+/* Appends the output of sinks sharing a file to the first one, separating
+ * the entries with empty lines as if they had been written together. */
+static void
+potool_close_sinks (GArray *sinks)
+{
+	PoSink *sinks_data = (PoSink *) sinks->data;
+	char buf[64 * 1024];
+	int i;
+
+	for (i = 0; i < sinks->len; i++) {
+		PoSink *sink = &sinks_data[i];
+
+		po_writer_finish (&sink->writer);
+		if (sink->writer.error != 0)
+			po_error (_("Writing %s failed: %s"), sink->fn, g_strerror (sink->writer.error));
+	}
+	for (i = 0; i < sinks->len; i++) {
+		PoSink *sink = &sinks_data[i], *owner = &sinks_data[sink->owner];
+		size_t n;
+
+		if (sink == owner) {
+			sink->file_written = sink->n_entries > 0;
+			continue;
+		}
+		if (sink->n_entries > 0 && owner->file_written && !sink->first_is_obsolete)
+			fputc ('\n', owner->out);
+		owner->file_written |= sink->n_entries > 0;
+		rewind (sink->out);
+		while ((n = fread (buf, 1, sizeof buf, sink->out)) > 0) {
+			if (fwrite (buf, 1, n, owner->out) != n)
+				break;
 		}
+		if (ferror (sink->out) || ferror (owner->out))
+			po_error (_("Writing %s failed: %s"), sink->fn, strerror (errno));
+		fclose (sink->out);
 	}
-	g_slist_free (pof->obsolete_entries);
-	pof->obsolete_entries = g_slist_reverse (npo_list);
+	for (i = 0; i < sinks->len; i++) {
+		PoSink *sink = &sinks_data[i];
 
+		if (sink->owner == i && sink->out != stdout && fclose (sink->out) != 0)
+			po_error (_("Writing %s failed: %s"), sink->fn, strerror (errno));
+	}
 }
 
-typedef enum {
-	FUZZY_FILTER            = 1 << 0,
-	NOT_FUZZY_FILTER        = 1 << 1,
-	TRANSLATED_FILTER       = 1 << 2,
-	NOT_TRANSLATED_FILTER   = 1 << 3,
-	NOT_TRANSLATED_H_FILTER	= 1 << 4, // same as NOT_TRANSLATED_FILTER but includes msgid "" header
-	OBSOLETE_FILTER         = 1 << 5,
-	NOT_OBSOLETE_FILTER     = 1 << 6,
-} PoFilters;
+static PoFile *
+potool_try_read (const char *fn, const char *cache_dir, int n_threads, PoFilters filters, GError **error)
+{
+	if (cache_dir != NULL)
+		return po_read_cached (fn, cache_dir, n_threads, filters, error);
+	return po_read_parallel (fn, n_threads, filters, error);
+}
+
+static PoFile *
+potool_read (const char *fn, const char *cache_dir, int n_threads, PoFilters filters)
+{
+	GError *error = NULL;
+	PoFile *pof;
 
+	if ((pof = potool_try_read (fn, cache_dir, n_threads, filters, &error)) == NULL)
+		po_error ("%s\n", error->message);
+	return pof;
+}
 
 static void
-po_apply_filters (PoFile *pof, PoFilters filters)
+potool_stream_file (PoFile *pof, PoStream *ps)
 {
-	if ((filters & FUZZY_FILTER) != 0) {
-		po_apply_filter (pof, po_filter_fuzzy);
-	}
-	if ((filters & NOT_FUZZY_FILTER) != 0) {
-		po_apply_filter (pof, po_filter_not_fuzzy);
+	PoEntry *po, *end;
+
+	for (po = (PoEntry *) pof->entries->data, end = po + pof->entries->len; po < end; po++) {
+		po_stream_entry (po, FALSE, ps);
 	}
-	if ((filters & TRANSLATED_FILTER) != 0) {
-		po_apply_filter (pof, po_filter_translated);
+	for (po = (PoEntry *) pof->obsolete_entries->data, end = po + pof->obsolete_entries->len; po < end; po++) {
+		po_stream_entry (po, TRUE, ps);
 	}
-	if ((filters & NOT_TRANSLATED_FILTER) != 0) {
-		po_apply_filter (pof, po_filter_not_translated);
+}
+
+/* The parts of entries which nothing in the single file mode uses, once the
+ * writers are set up, so that the parser leaves them out. */
+static po_write_modes
+potool_stream_omit (PoStream *ps)
+{
+	po_write_modes omit = NO_CTX | NO_ID | NO_STR | NO_TRANSLATION | NO_STD_COMMENT |
+	                      NO_POS_COMMENT | NO_SPEC_COMMENT | NO_RES_COMMENT | NO_PREVIOUS;
+	PoSink *sink = (PoSink *) ps->sinks->data, *end = sink + ps->sinks->len;
+
+	/* without sinks, the writer is not used with the statistics */
+	if (ps->sinks->len == 0 && ps->stats_mode == NO_STATS)
+		omit &= ps->writer.mode;
+	for (; sink < end; sink++) {
+		omit &= sink->writer.mode;
 	}
-	if ((filters & NOT_TRANSLATED_H_FILTER) != 0) {
-		po_apply_filter (pof, po_filter_not_translated_and_header);
+	if (ps->stats_mode == FULL_STATS || ps->stats_mode == RAW_STATS)
+		omit &= ~(NO_ID | NO_STR | NO_TRANSLATION);
+	/* converting needs the header's msgstr and hashes the msgids again,
+	 * and -c writes the msgids as translations */
+	if (ps->charset != NULL || ps->copy_msgid)
+		omit &= ~(NO_CTX | NO_ID | NO_STR | NO_TRANSLATION);
+	return omit;
+}
+
+static void
+potool_stream_finish (PoStream *ps)
+{
+	if (ps->recoder != NULL) {
+		po_recoder_free (ps->recoder);
+		po_arena_free (ps->arena);
 	}
-	if ((filters & OBSOLETE_FILTER) != 0) {
-		g_slist_free_custom (pof->entries, po_entry_free);
-		pof->entries = NULL;
+}
+
+static void
+potool_recode (PoFile *pof, const char *charset, const char *fn)
+{
+	GError *error = NULL;
+
+	if (!po_recode_file (pof, charset, &error))
+		po_error (_("Converting %s to %s failed: %s"), fn, charset, error->message);
+}
+
+static void
+potool_file_stats (PoFile *pof, PoFilters filters, PoStatsModes mode, FILE *out)
+{
+	PoStats st = { 0 };
+	PoEntry *po, *end;
+
+	for (po = (PoEntry *) pof->entries->data, end = po + pof->entries->len; po < end; po++) {
+		if (po_entry_filter (po, filters))
+			po_stats_add (&st, po, FALSE);
 	}
-	if ((filters & NOT_OBSOLETE_FILTER) != 0) {
-		g_slist_free_custom (pof->obsolete_entries, po_entry_free);
-		pof->obsolete_entries = NULL;
+	for (po = (PoEntry *) pof->obsolete_entries->data, end = po + pof->obsolete_entries->len; po < end; po++) {
+		if (po_entry_filter (po, filters))
+			po_stats_add (&st, po, TRUE);
 	}
+	po_stats_print (&st, mode, out);
 }
 
+/* The work file is converted to the charset of the base file, so that
+ * it may be edited in another one. */
 static void
-po_copy_msgid (PoFile *pof)
+potool_recode_work (PoFile *bpof, PoFile *pof, const char *fn)
 {
-	GSList *l;
+	PoEntry *bheader = po_file_header (bpof), *header = po_file_header (pof);
+	char *bcharset, *charset;
 
-	for (l = pof->entries; l != NULL; l = l->next) {
-		PoEntry *po = l->data;
+	if (bheader == NULL || header == NULL)
+		return;
+	bcharset = po_entry_charset (bheader);
+	charset = po_entry_charset (header);
+	if (bcharset != NULL && charset != NULL && g_ascii_strcasecmp (bcharset, charset) != 0)
+		potool_recode (pof, bcharset, fn);
+	g_free (bcharset);
+	g_free (charset);
+}
 
-		if (po->str) {
-			stringblock_free (po->str);
-			po->str = stringblock_dup (po->id);
-		} else {
-			MsgStrX *m = g_new (MsgStrX, 1);
-			m->n = 0;
-			m->str = stringblock_dup (po->id);
-			g_slist_free_custom (po->msgstrxs, msgstrx_free);
-			po->msgstrxs = g_slist_append(NULL, m);
+/* --- extracting --- */
+
+/* Writes a single entry of fn, given either its number, counting from 1,
+ * or its msgid, preceded by the msgctxt and an EOT character if it has
+ * one, as in MO files. */
+static void
+potool_extract (const char *fn, int n, const char *key, const char *cache_dir, int n_threads, PoWriter *pw)
+{
+	GError *error = NULL;
+	const char *id = key, *eot;
+	char *ctx = NULL;
+	PoFile *pof;
+
+	potool_phase (PHASE_READ);
+	if (key != NULL) {
+		if ((eot = strchr (key, '\004')) != NULL) {
+			ctx = g_strndup (key, eot - key);
+			id = eot + 1;
 		}
+		pof = po_read_entry_id (fn, cache_dir, n_threads, ctx, id, &error);
+	} else {
+		pof = po_read_entry (fn, cache_dir, n_threads, n - 1, &error);
 	}
+	if (pof == NULL)
+		po_error ("%s\n", error->message);
+	if (pof->entries->len + pof->obsolete_entries->len == 0)
+		po_error (_("No such entry in %s"), fn);
+	potool_phase (PHASE_WRITE);
+	po_write (pw, pof);
+	potool_finish_write (pw);
+	potool_phase (PHASE_OTHER);
+	po_free (pof);
+	g_free (ctx);
+}
+
+/* --- suggesting --- */
 
+/* Gives the untranslated entries of pof the translations of similar msgids
+ * from the files in tm_fns, which are converted to the charset of pof, and
+ * then adopted by it. */
+static void
+potool_suggest (PoFile *pof, GPtrArray *tm_fns, int min_similarity, const char *cache_dir, int n_threads)
+{
+	PoMemory *tm = po_memory_new ();
+	PoFile **refs = g_new (PoFile *, tm_fns->len);
+	PotoolPhase prev;
+	int i;
+
+	prev = potool_phase (PHASE_READ);
+	for (i = 0; i < tm_fns->len; i++) {
+		char *fn = g_ptr_array_index (tm_fns, i);
+
+		refs[i] = potool_read (fn, cache_dir, n_threads, 0);
+		potool_recode_work (pof, refs[i], fn);
+		po_memory_add (tm, refs[i]);
+	}
+	potool_phase (PHASE_SUGGEST);
+	po_memory_suggest (tm, pof, min_similarity / 100.0);
+	po_memory_free (tm);
+	for (i = 0; i < tm_fns->len; i++) {
+		po_adopt (pof, refs[i]);
+	}
+	g_free (refs);
+	potool_phase (prev);
 }
 
-/* --- */
+/* --- compiling --- */
 
-typedef enum {
-	NO_CTX		= 1 << 0,
-	NO_ID           = 1 << 1,
-	NO_STR          = 1 << 2,
-	NO_STD_COMMENT  = 1 << 3,
-	NO_POS_COMMENT  = 1 << 4,
-	NO_SPEC_COMMENT = 1 << 5,
-	NO_RES_COMMENT  = 1 << 6,
-	NO_PREVIOUS     = 1 << 7,
-	NO_TRANSLATION  = 1 << 8,
-	NO_LINF         = 1 << 9
-} po_write_modes;
-
-enum {
-	SEP1 = ' ',
-	SEP2 = '\t'
-};
+typedef struct {
+	const char *cache_dir;
+	int n_threads;          /* for parsing each file */
+	PoFilters filters;
+	const char *charset;
+} PoCompileOptions;
+
+typedef struct {
+	const char *fn;
+	char *mo_fn;
+	GError *error;
+} PoCompileJob;
 
-int potool_printf(char *format, ...)
+static void
+potool_compile_job (gpointer data, gpointer user_data)
 {
-	va_list ap;
-	int ret;
-	va_start(ap, format);
-	ret = vprintf(format, ap);
-	if (ret < 0)
-		po_error(_("printf() failed with code %d: %s"), ret, strerror(errno));
-	va_end(ap);
-	return ret;
+	PoCompileJob *job = data;
+	PoCompileOptions *opts = user_data;
+	PoFile *pof;
+
+	pof = potool_try_read (job->fn, opts->cache_dir, opts->n_threads, opts->filters, &job->error);
+	if (pof == NULL)
+		return;
+	if (opts->charset == NULL || po_recode_file (pof, opts->charset, &job->error))
+		po_write_mo (pof, job->mo_fn, &job->error);
+	po_free (pof);
 }
 
+/* Compiles every file into out, or into a .mo file named after it, if out
+ * is a directory. Several files are compiled by up to n_threads threads at
+ * once, and the errors are reported when all of them are done. */
 static void
-print_multi_line (const StringBlock *s, int start_offset, const char *prefix, gboolean preserve_wrapping)
-{
-	int slen, prefix_len;
-	char *eol_ptr;
-	gboolean has_final_eol;
-	char **lines, **ln;
-	enum { max_len = 77 };
-
-	if (preserve_wrapping) {
-		int i, offset = 0;
-		for (i = 0; i < s->num_lines; i++) {
-			int line_len = s->line_lengths[i];
-			if (i > 0) {
-				potool_printf ("%s", prefix);
+potool_compile (char **fns, int n_fns, const char *out, int n_threads, PoCompileOptions *opts)
+{
+	PoCompileJob *jobs = g_new0 (PoCompileJob, n_fns);
+	gboolean to_dir = g_file_test (out, G_FILE_TEST_IS_DIR);
+	GHashTable *mo_fns = g_hash_table_new (g_str_hash, g_str_equal);
+	gboolean failed = FALSE;
+	int i;
+
+	if (n_fns > 1 && !to_dir)
+		po_error (_("Compiling several files needs a directory, not %s"), out);
+	for (i = 0; i < n_fns; i++) {
+		jobs[i].fn = fns[i];
+		if (to_dir) {
+			char *name, *mo_name, *other;
+
+			if (strcmp (fns[i], "-") == 0)
+				po_error (_("Can't name a compiled file after the standard input"));
+			name = g_path_get_basename (fns[i]);
+			if (g_str_has_suffix (name, ".po"))
+				name[strlen (name) - 3] = '\0';
+			mo_name = g_strconcat (name, ".mo", NULL);
+			jobs[i].mo_fn = g_build_filename (out, mo_name, NULL);
+			g_free (mo_name);
+			g_free (name);
+			/* the jobs would overwrite each other's output */
+			if ((other = g_hash_table_lookup (mo_fns, jobs[i].mo_fn)) != NULL) {
+				po_error (_("%s and %s would both be compiled to %s"),
+				          other, fns[i], jobs[i].mo_fn);
 			}
-			potool_printf ("\"%.*s\"\n", line_len, s->str + offset);
-			offset += line_len;
+			g_hash_table_insert (mo_fns, jobs[i].mo_fn, fns[i]);
+		} else {
+			jobs[i].mo_fn = g_strdup (out);
 		}
-		return;
 	}
+	g_hash_table_destroy (mo_fns);
+	if (n_fns == 1) {
+		opts->n_threads = n_threads;
+		potool_compile_job (&jobs[0], opts);
+	} else {
+		GThreadPool *pool = g_thread_pool_new (potool_compile_job, opts, n_threads, TRUE, NULL);
 
-	slen = strlen (s->str);
-	eol_ptr = strstr (s->str, "\\n");
-	if ((eol_ptr == NULL || (eol_ptr - s->str + 2 == slen))
-	    && slen < (RMARGIN - 2 - start_offset)) {
-		potool_printf ("\"%s\"\n", s->str);
-		return;
+		opts->n_threads = 1;
+		for (i = 0; i < n_fns; i++) {
+			g_thread_pool_push (pool, &jobs[i], NULL);
+		}
+		g_thread_pool_free (pool, FALSE, TRUE);
+	}
+	for (i = 0; i < n_fns; i++) {
+		if (jobs[i].error != NULL) {
+			g_critical ("%s: %s", jobs[i].fn, jobs[i].error->message);
+			g_error_free (jobs[i].error);
+			failed = TRUE;
+		}
+		g_free (jobs[i].mo_fn);
 	}
+	g_free (jobs);
+	if (failed)
+		exit (1);
+}
 
-	potool_printf ("\"\"\n");
-	prefix_len = strlen (prefix);
-	has_final_eol = strcmp (s->str + slen - 2, "\\n") == 0;
-	lines = g_strsplit (s->str, "\\n", 0);
-	for (ln = lines; *ln != NULL; ln++) {
-		char *cur;
-		int offset;
-		gboolean line_has_eol;
+/* --- serving --- */
 
-#if GLIB_MAJOR_VERSION == 2
-		if (*ln[0] == '\0' && *(ln + 1) == NULL)
-			continue;
-#endif
-		potool_printf ("%s\"", prefix);
-		line_has_eol = has_final_eol || *(ln + 1) != NULL;
-		offset = prefix_len;
-		cur = *ln;
-		do {
-			int word_len = 0;
-			int eol_len;
-			int ret;
-
-			while (cur[word_len] != SEP1 && cur[word_len] != SEP2 &&
-			       cur[word_len] != '\0')
-				word_len++;
-			while (cur[word_len] == SEP1 || cur[word_len] == SEP2)
-				word_len++;
-
-			if (line_has_eol && cur[word_len] == '\0' &&
-			    (word_len == 0 || (cur[word_len - 1] != SEP1 && cur[word_len - 1] != SEP2))) {
-				eol_len = 2;
-			} else {
-				eol_len = 0;
-			}
-			if (offset + word_len + eol_len > max_len) {
-				potool_printf ("\"\n%s\"", prefix);
-				offset = prefix_len;
-			}
-			if ((ret = fwrite(cur, 1, word_len, stdout)) != word_len)
-				po_error(_("fwrite() failed, returned %d instead of %d: %s"), ret, word_len, strerror(errno));
-			offset += word_len;
-			cur += word_len;
-		} while (*cur != '\0');
-
-		if (line_has_eol) {
-			if (offset + 2 > max_len) {
-				potool_printf ("\"\n%s\"\\n", prefix);
-			} else {
-				potool_printf ("\\n");
-			}
-		}
-		potool_printf ("\"\n");
+/* With -D, potool keeps the files asked about in memory and answers
+ * requests read from a Unix socket, one per line:
+ *
+ *   stats [-s|-S|-R] [-fFILTER]... FILE
+ *   write [-fFILTER]... [-nPARAMETER]... [-p] FILE
+ *   lookup [-nPARAMETER]... [-p] FILE MSGID [MSGCTXT]
+ *   quit
+ *
+ * Words are separated by spaces, and may be quoted like strings in po
+ * files. Escape sequences are resolved in file names, but a msgid or
+ * msgctxt is given as it is written in the file. The answer is a line
+ * with "OK" and the length of what follows it, or "ERROR" and a message.
+ * A file is only read again once inotify has reported a change to it.
+ */
+
+static int
+potool_socket (const char *fn, struct sockaddr_un *addr)
+{
+	memset (addr, 0, sizeof *addr);
+	addr->sun_family = AF_UNIX;
+	if (strlen (fn) >= sizeof addr->sun_path) {
+		errno = ENAMETOOLONG;
+		return -1;
 	}
-	g_strfreev (lines);
+	strcpy (addr->sun_path, fn);
+	return socket (AF_UNIX, SOCK_STREAM, 0);
 }
 
+static int
+potool_connect (const char *fn)
+{
+	struct sockaddr_un addr;
+	int fd = potool_socket (fn, &addr);
+
+	if (fd >= 0 && connect (fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+		int saved_errno = errno;
+
+		close (fd);
+		errno = saved_errno;
+		return -1;
+	}
+	return fd;
+}
+
+/* Quotes an escaped string, as it would be in a po file. */
 static void
-write_msgstr (char *prefix, StringBlock *str, GSList *strn, po_write_modes mode, gboolean preserve_wrapping)
+potool_append_quoted (GString *req, const char *s)
 {
-	int prefix_len = strlen(prefix);
+	g_string_append_c (req, '"');
+	for (; *s != '\0'; s++) {
+		if (*s == '\\' && s[1] != '\0') {
+			g_string_append_len (req, s++, 2);
+		} else if (*s == '\\' || *s == '"') {
+			g_string_append_c (req, '\\');
+			g_string_append_c (req, *s);
+		} else if (*s == '\n') {
+			g_string_append (req, "\\n");
+		} else {
+			g_string_append_c (req, *s);
+		}
+	}
+	g_string_append_c (req, '"');
+}
 
-	if (!(mode & NO_TRANSLATION)) {
-		if (str && str->str) {
-			potool_printf ("%smsgstr ", prefix);
-			print_multi_line (str, 7 + prefix_len, prefix, preserve_wrapping);
+/* Sends a request to a server started with -D, and copies the answer to
+ * the standard output. The file name is made absolute, as the server may
+ * have been started elsewhere. */
+static void
+potool_query (const char *socket_fn, char **args, int n_args, GString *opts)
+{
+	GString *req;
+	FILE *sock;
+	char *line = NULL;
+	size_t size = 0;
+	int fd, i;
+
+	if (n_args == 0)
+		po_error (_("No request given!"));
+	req = g_string_new (args[0]);
+	g_string_append (req, opts->str);
+	for (i = 1; i < n_args; i++) {
+		g_string_append_c (req, ' ');
+		if (i == 1) {
+			char *cwd = g_get_current_dir ();
+			char *fn = g_path_is_absolute (args[i]) ? g_strdup (args[i]) : g_build_filename (cwd, args[i], NULL);
+			char *escaped = g_strescape (fn, NULL);
+
+			g_string_append_printf (req, "\"%s\"", escaped);
+			g_free (escaped);
+			g_free (fn);
+			g_free (cwd);
 		} else {
-			GSList *x;
-			for (x = strn; x != NULL; x = x->next) {
-				MsgStrX *m = x->data;
-				potool_printf ("%smsgstr[%d] ", prefix, m->n);
-				print_multi_line (m->str, 10 + prefix_len, prefix, preserve_wrapping);
-			}
+			potool_append_quoted (req, args[i]);
 		}
+	}
+	g_string_append_c (req, '\n');
+
+	if ((fd = potool_connect (socket_fn)) < 0 || (sock = fdopen (fd, "r+")) == NULL)
+		po_error (_("Can't connect to %s: %s"), socket_fn, g_strerror (errno));
+	if (fwrite (req->str, 1, req->len, sock) != req->len || fflush (sock) != 0)
+		po_error (_("Can't send the request to %s: %s"), socket_fn, g_strerror (errno));
+	if (getline (&line, &size, sock) < 0)
+		po_error (_("No answer from %s"), socket_fn);
+	if (strncmp (line, "OK ", 3) == 0) {
+		gsize len = g_ascii_strtoull (line + 3, NULL, 10), n;
+		char buf[64 * 1024];
+
+		for (; len > 0 && (n = fread (buf, 1, MIN (len, sizeof buf), sock)) > 0; len -= n) {
+			if (fwrite (buf, 1, n, stdout) != n)
+				po_error (_("Writing output failed: %s"), g_strerror (errno));
+		}
+		if (len > 0)
+			po_error (_("Incomplete answer from %s"), socket_fn);
 	} else {
-		potool_printf ("%smsgstr \"\"\n", prefix);
+		g_strchomp (line);
+		po_error ("%s", g_str_has_prefix (line, "ERROR ") ? line + 6 : line);
 	}
+	fclose (sock);
+	free (line);
+	g_string_free (req, TRUE);
 }
 
+#ifdef __linux__
+
+typedef struct {
+	char *fn;               /* without symbolic links */
+	char *name;             /* in its directory */
+	int wd;                 /* watching the directory */
+	PoFile *pof;            /* NULL until read again */
+	PoIndex *index;
+} PoCatalog;
+
+typedef struct {
+	GMainLoop *loop;
+	GHashTable *catalogs;   /* by file name */
+	PoPool *pool;           /* shared by all the catalogs */
+	guint pool_live;        /* strings in the pool when it was made */
+	int inotify_fd;
+	const char *cache_dir;
+	int n_threads;
+} PoServer;
+
+typedef struct {
+	PoServer *srv;
+	int fd;
+	GIOCondition waiting;   /* for reading or for writing */
+	GString *in;            /* requests not answered yet */
+	GString *out;           /* the answer being sent */
+	gsize sent;             /* of out */
+} PoClient;
+
 static void
-po_write (PoFile *pof, po_write_modes mode, gboolean preserve_wrapping)
+po_catalog_drop (PoCatalog *cat)
 {
-	GSList *l;
+	if (cat->pof != NULL) {
+		po_index_free (cat->index);
+		po_free (cat->pof);
+		cat->pof = NULL;
+	}
+}
 
-	for (l = pof->entries; l != NULL; l = l->next) {
-		PoEntry *po = l->data;
-		GSList *ll;
+static void
+po_catalog_free (gpointer data)
+{
+	PoCatalog *cat = data;
 
-		if (!(mode & NO_STD_COMMENT)) {
-			for (ll = po->comments.std; ll != NULL; ll = ll->next) {
-				potool_printf ("#%s\n", (char *) ll->data);
-			}
-		}
-		if (!(mode & NO_RES_COMMENT)) {
-			for (ll = po->comments.res; ll != NULL; ll = ll->next) {
-				potool_printf ("#%s\n", (char *) ll->data);
-			}
-		}
-		if (!(mode & NO_POS_COMMENT)) {
-			if (!(mode & NO_LINF)) {
-				for (ll = po->comments.pos; ll != NULL; ll = ll->next) {
-					potool_printf ("#:%s\n", (char *) ll->data);
-				}
-			} else {
-				for (ll = po->comments.pos; ll != NULL; ll = ll->next) {
-					char *s = g_strdup ((char *) ll->data);
-					char *l, *r;
-
-					l = r = s;
-					while (*r != '\0') {
-						if (*r == ':') {
-							*l++ = ':';
-							*l++ = '1';
-							while (isdigit (*++r))
-								;
-						} else {
-							*l++ = *r++;
-						}
-					}
-					*l = '\0';
-					potool_printf ("#:%s\n", s);
-					g_free (s);
-				}
-			}
-		}
-		if (!(mode & NO_SPEC_COMMENT)) {
-			for (ll = po->comments.spec; ll != NULL; ll = ll->next) {
-				potool_printf ("#,%s\n", (char *) ll->data);
-			}
-		}
-		if (!(mode & NO_PREVIOUS)) {
-			if (po->previous.ctx) {
-				potool_printf ("#| msgctxt ");
-				print_multi_line (po->previous.ctx, 11, "", preserve_wrapping);
-			}
-			if (po->previous.id) {
-				potool_printf ("#| msgid ");
-				print_multi_line (po->previous.id, 9, "", preserve_wrapping);
-			}
-			if (po->previous.id_plural) {
-				potool_printf ("#| msgid_plural ");
-				print_multi_line (po->previous.id, 16, "", preserve_wrapping);
-			}
-		}
-		if ((!(mode & NO_CTX)) && po->ctx) {
-			potool_printf ("msgctxt ");
-			print_multi_line (po->ctx, 8, "", preserve_wrapping);
-		}
-		if (!(mode & NO_ID)) {
-			potool_printf ("msgid ");
-			print_multi_line (po->id, 6, "", preserve_wrapping);
-			if (po->id_plural) {
-				potool_printf ("msgid_plural ");
-				print_multi_line (po->id_plural, 13, "", preserve_wrapping);
-			}
-		}
-		if (!(mode & NO_STR)) {
-			write_msgstr ("", po->str, po->msgstrxs, mode, preserve_wrapping);
-		}
+	po_catalog_drop (cat);
+	g_free (cat->fn);
+	g_free (cat->name);
+	g_free (cat);
+}
 
-		if (l->next != NULL) {
-			potool_printf ("\n");
-		}
-	}
+/* Below this, the strings of dropped catalogs are not worth the trouble. */
+#define POOL_MIN_STRINGS 65536
+
+/* Nothing leaves the pool, so the strings of catalogs which were read
+ * again or forgotten pile up in it. Once it has doubled since it was made,
+ * the catalogs still loaded are moved to a new one, which the old one's
+ * strings do not survive. That bounds the memory wasted by the strings to
+ * what the loaded catalogs use, and the copying to a constant amount per
+ * string added. */
+static void
+server_repool (PoServer *srv)
+{
+	guint size = po_pool_size (srv->pool);
+	GHashTableIter iter;
+	gpointer value;
+	PoPool *pool;
 
-	if (pof->obsolete_entries != NULL) {
-		potool_printf ("\n");
+	if (size < POOL_MIN_STRINGS || size <= 2 * srv->pool_live)
+		return;
+	pool = po_pool_new ();
+	g_hash_table_iter_init (&iter, srv->catalogs);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		PoCatalog *cat = value;
+
+		if (cat->pof != NULL)
+			po_intern (pool, cat->pof);
 	}
+	po_pool_free (srv->pool);
+	srv->pool = pool;
+	srv->pool_live = po_pool_size (pool);
+}
 
-	for (l = pof->obsolete_entries; l != NULL; l = l->next) {
-		PoEntry *po = l->data;
-		GSList *ll;
+/* The directory is watched, rather than the file, so that replacing the
+ * file by renaming another one is noticed too. */
+static PoCatalog *
+server_catalog (PoServer *srv, const char *fn, GError **error)
+{
+	char *real = realpath (fn, NULL);
+	PoCatalog *cat;
 
-		if (!(mode & NO_STD_COMMENT)) {
-			for (ll = po->comments.std; ll != NULL; ll = ll->next) {
-				potool_printf ("#%s\n", (char *) ll->data);
-			}
+	if (real == NULL) {
+		g_set_error (error, PO_ERROR, PO_ERROR_OPEN,
+		             _("Can't open input file %s: %s"), fn, g_strerror (errno));
+		return NULL;
+	}
+	if ((cat = g_hash_table_lookup (srv->catalogs, real)) == NULL) {
+		char *dir = g_path_get_dirname (real);
+		int wd;
+
+		/* before reading, so that no change is missed */
+		wd = inotify_add_watch (srv->inotify_fd, dir,
+		                        IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE |
+		                        IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+		g_free (dir);
+		if (wd < 0) {
+			g_set_error (error, PO_ERROR, PO_ERROR_OPEN,
+			             _("Can't watch %s: %s"), real, g_strerror (errno));
+			g_free (real);
+			return NULL;
 		}
-		if (!(mode & NO_SPEC_COMMENT)) {
-			for (ll = po->comments.spec; ll != NULL; ll = ll->next) {
-				potool_printf ("#,%s\n", (char *) ll->data);
+		cat = g_new0 (PoCatalog, 1);
+		cat->fn = real;
+		cat->name = g_path_get_basename (real);
+		cat->wd = wd;
+		g_hash_table_insert (srv->catalogs, cat->fn, cat);
+	} else {
+		g_free (real);
+	}
+	if (cat->pof == NULL) {
+		cat->pof = potool_try_read (cat->fn, srv->cache_dir, srv->n_threads, 0, error);
+		if (cat->pof == NULL)
+			return NULL;
+		po_intern (srv->pool, cat->pof);
+		cat->index = po_index_new (cat->pof->entries);
+		server_repool (srv);
+	}
+	return cat;
+}
+
+/* All the catalogs of a directory share its watch, which goes once the
+ * last of them does. */
+static void
+server_unwatch (PoServer *srv, int wd)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init (&iter, srv->catalogs);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		if (((PoCatalog *) value)->wd == wd)
+			return;
+	}
+	inotify_rm_watch (srv->inotify_fd, wd);
+}
+
+/* Changed files are forgotten, and read again when next asked about.
+ * Files which are gone are forgotten along with their catalogs. */
+static gboolean
+server_inotify (gint fd, GIOCondition condition, gpointer data)
+{
+	PoServer *srv = data;
+	char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+	ssize_t len;
+
+	while ((len = read (fd, buf, sizeof buf)) > 0) {
+		const struct inotify_event *ev;
+		char *p;
+
+		for (p = buf; p < buf + len; p += sizeof (struct inotify_event) + ev->len) {
+			GHashTableIter iter;
+			gpointer value;
+			gboolean removed = FALSE;
+
+			ev = (const struct inotify_event *) p;
+			g_hash_table_iter_init (&iter, srv->catalogs);
+			while (g_hash_table_iter_next (&iter, NULL, &value)) {
+				PoCatalog *cat = value;
+
+				if (ev->mask & IN_Q_OVERFLOW) {
+					po_catalog_drop (cat);
+				} else if (cat->wd != ev->wd) {
+					continue;
+				} else if (ev->mask & IN_IGNORED) {
+					/* the directory is gone */
+					g_hash_table_iter_remove (&iter);
+				} else if (ev->len > 0 && strcmp (ev->name, cat->name) == 0) {
+					if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+						g_hash_table_iter_remove (&iter);
+						removed = TRUE;
+					} else {
+						po_catalog_drop (cat);
+					}
+				}
 			}
+			if (removed)
+				server_unwatch (srv, ev->wd);
 		}
-		if (!(mode & NO_PREVIOUS)) {
-			if (po->previous.ctx) {
-				potool_printf ("#~| msgctxt ");
-				print_multi_line (po->previous.ctx, 12, "", preserve_wrapping);
-			}
-			if (po->previous.id) {
-				potool_printf ("#~| msgid ");
-				print_multi_line (po->previous.id, 10, "", preserve_wrapping);
-			}
-			if (po->previous.id_plural) {
-				potool_printf ("#~| msgid_plural ");
-				print_multi_line (po->previous.id, 17, "", preserve_wrapping);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+/* Splits a request into words. A quoted word ends at the first unescaped
+ * quote. */
+static char **
+server_split (const char *s)
+{
+	GPtrArray *words = g_ptr_array_new ();
+
+	for (;;) {
+		const char *start;
+
+		while (*s == ' ')
+			s++;
+		if (*s == '\0')
+			break;
+		if (*s == '"') {
+			for (start = ++s; *s != '"'; s++) {
+				if (*s == '\0' || (*s == '\\' && *++s == '\0')) {
+					g_ptr_array_add (words, NULL);
+					g_strfreev ((char **) g_ptr_array_free (words, FALSE));
+					return NULL;
+				}
 			}
+			g_ptr_array_add (words, g_strndup (start, s - start));
+			s++;
+		} else {
+			for (start = s; *s != '\0' && *s != ' '; s++)
+				;
+			g_ptr_array_add (words, g_strndup (start, s - start));
 		}
+	}
+	g_ptr_array_add (words, NULL);
+	return (char **) g_ptr_array_free (words, FALSE);
+}
 
-		if ((!(mode & NO_CTX)) && po->ctx) {
-			potool_printf ("#~ msgctxt ");
-			print_multi_line (po->ctx, 11, "#~ ", preserve_wrapping);
+/* Writes the answer to out, or returns an error message. */
+static char *
+server_answer (PoServer *srv, char **words, FILE *out)
+{
+	PoStatsModes stats_mode = RAW_STATS;
+	PoFilters filters = 0, filter;
+	po_write_modes mode = 0, m;
+	gboolean preserve_wrapping = FALSE;
+	const char *req = words[0];
+	PoCatalog *cat;
+	PoEntry *po, *end;
+	PoWriter pw;
+	GError *error = NULL;
+	char **w, *fn;
+	int n_args;
+
+	for (w = words + 1; *w != NULL && **w == '-'; w++) {
+		if (strcmp (*w, "-s") == 0) {
+			stats_mode = COUNT_STATS;
+		} else if (strcmp (*w, "-S") == 0) {
+			stats_mode = FULL_STATS;
+		} else if (strcmp (*w, "-R") == 0) {
+			stats_mode = RAW_STATS;
+		} else if (strcmp (*w, "-p") == 0) {
+			preserve_wrapping = TRUE;
+		} else if (strncmp (*w, "-f", 2) == 0 && (filter = potool_find_filter (*w + 2)) != 0) {
+			filters |= filter;
+		} else if (strncmp (*w, "-n", 2) == 0 && (m = potool_find_write_mode (*w + 2)) != 0) {
+			mode |= m;
+		} else {
+			return g_strdup_printf (_("Unknown option \"%s\""), *w);
 		}
-
-		if (!(mode & NO_ID)) {
-			potool_printf ("#~ msgid ");
-			print_multi_line (po->id, 9, "#~ ", preserve_wrapping);
-			if (po->id_plural) {
-				potool_printf ("#~ msgid_plural ");
-				print_multi_line (po->id_plural, 16, "#~ ", preserve_wrapping);
-			}
+	}
+	n_args = g_strv_length (w);
+	if (strcmp (req, "quit") == 0 && n_args == 0) {
+		g_main_loop_quit (srv->loop);
+		return NULL;
+	}
+	if (!((strcmp (req, "stats") == 0 || strcmp (req, "write") == 0) && n_args == 1) &&
+	    !(strcmp (req, "lookup") == 0 && (n_args == 2 || n_args == 3)))
+		return g_strdup_printf (_("Invalid request \"%s\""), req);
+
+	/* changes made before the request was sent count, whatever order the
+	 * main loop would see them in */
+	server_inotify (srv->inotify_fd, G_IO_IN, srv);
+	fn = g_strcompress (w[0]);
+	cat = server_catalog (srv, fn, &error);
+	g_free (fn);
+	if (cat == NULL) {
+		fn = g_strdup (error->message);
+		g_error_free (error);
+		return fn;
+	}
+	if (strcmp (req, "stats") == 0) {
+		potool_file_stats (cat->pof, filters, stats_mode, out);
+		return NULL;
+	}
+	if (strcmp (req, "lookup") == 0) {
+		StringBlock ctx = { w[2] }, id = { w[1] };
+		PoEntry key;
+
+		key.ctx = n_args == 3 ? &ctx : NULL;
+		key.id = &id;
+		key.hash = po_entry_hash (key.ctx, key.id);
+		if ((po = po_index_lookup (cat->index, &key)) == NULL)
+			return g_strdup_printf (_("No entry with msgid \"%s\""), w[1]);
+		po_writer_init (&pw, out, mode, preserve_wrapping);
+		po_write_entry (&pw, po, FALSE);
+	} else {
+		po_writer_init (&pw, out, mode, preserve_wrapping);
+		for (po = (PoEntry *) cat->pof->entries->data, end = po + cat->pof->entries->len; po < end; po++) {
+			if (po_entry_filter (po, filters))
+				po_write_entry (&pw, po, FALSE);
 		}
-		if (!(mode & NO_STR)) {
-			write_msgstr ("#~ ", po->str, po->msgstrxs, mode, preserve_wrapping);
+		for (po = (PoEntry *) cat->pof->obsolete_entries->data, end = po + cat->pof->obsolete_entries->len; po < end; po++) {
+			if (po_entry_filter (po, filters))
+				po_write_entry (&pw, po, TRUE);
 		}
+	}
+	po_writer_finish (&pw);
+	return NULL;
+}
 
-		if (l->next != NULL) {
-			potool_printf ("\n");
+/* Puts the answer to a request into reply. */
+static void
+server_request (PoServer *srv, GString *reply, const char *line)
+{
+	char **words = server_split (line), *body = NULL, *message;
+	size_t len = 0;
+	FILE *out = open_memstream (&body, &len);
+
+	if (out == NULL)
+		po_error (_("open_memstream() failed: %s"), g_strerror (errno));
+	if (words == NULL || words[0] == NULL) {
+		message = g_strdup (_("Invalid request"));
+	} else {
+		message = server_answer (srv, words, out);
+	}
+	fclose (out);
+	if (message == NULL) {
+		g_string_append_printf (reply, "OK %lu\n", (unsigned long) len);
+		g_string_append_len (reply, body, len);
+	} else {
+		g_string_append_printf (reply, "ERROR %s\n", g_strdelimit (message, "\n", ' '));
+	}
+	g_free (message);
+	free (body);
+	g_strfreev (words);
+}
+
+/* Sends what the socket takes of the answer being sent, and answers the
+ * next request once it is all gone. Returns FALSE if the client has gone
+ * away, or sent too long a request. */
+static gboolean
+server_client_flush (PoClient *cl)
+{
+	for (;;) {
+		char *nl;
+
+		if (cl->sent < cl->out->len) {
+			ssize_t n = send (cl->fd, cl->out->str + cl->sent, cl->out->len - cl->sent, MSG_NOSIGNAL);
+
+			if (n < 0 && errno == EAGAIN)
+				return TRUE;
+			if (n < 0 && errno != EINTR)
+				return FALSE;
+			if (n > 0)
+				cl->sent += n;
+			continue;
 		}
+		g_string_truncate (cl->out, 0);
+		cl->sent = 0;
+		if ((nl = memchr (cl->in->str, '\n', cl->in->len)) == NULL)
+			return cl->in->len < 1024 * 1024;
+		*nl = '\0';
+		server_request (cl->srv, cl->out, cl->in->str);
+		g_string_erase (cl->in, 0, nl + 1 - cl->in->str);
 	}
 }
 
-/* - */
+/* The socket is non-blocking, and watched for writing only while an
+ * answer waits to be sent, so a client which does not read its answers
+ * holds up nobody but itself. Nothing more is read from it meanwhile. */
+static gboolean
+server_client (gint fd, GIOCondition condition, gpointer data)
+{
+	PoClient *cl = data;
+	GIOCondition waiting;
+	gboolean ok = TRUE;
+
+	if (condition & G_IO_IN) {
+		char buf[4096];
+		ssize_t n = read (fd, buf, sizeof buf);
+
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			return G_SOURCE_CONTINUE;
+		ok = n > 0;
+		if (ok)
+			g_string_append_len (cl->in, buf, n);
+	} else if (!(condition & G_IO_OUT)) {
+		ok = FALSE;
+	}
+	if (ok && server_client_flush (cl)) {
+		waiting = cl->sent < cl->out->len ? G_IO_OUT : G_IO_IN;
+		if (waiting == cl->waiting)
+			return G_SOURCE_CONTINUE;
+		cl->waiting = waiting;
+		g_unix_fd_add (fd, waiting | G_IO_HUP | G_IO_ERR, server_client, cl);
+		return G_SOURCE_REMOVE;
+	}
+	close (fd);
+	g_string_free (cl->in, TRUE);
+	g_string_free (cl->out, TRUE);
+	g_free (cl);
+	return G_SOURCE_REMOVE;
+}
 
-typedef GHashTable PoEntry_set;
+static gboolean
+server_accept (gint fd, GIOCondition condition, gpointer data)
+{
+	PoClient *cl;
+	int client_fd = accept (fd, NULL, NULL);
+
+	if (client_fd < 0)
+		return G_SOURCE_CONTINUE;
+	g_unix_set_fd_nonblocking (client_fd, TRUE, NULL);
+	cl = g_new (PoClient, 1);
+	cl->srv = data;
+	cl->fd = client_fd;
+	cl->waiting = G_IO_IN;
+	cl->in = g_string_new (NULL);
+	cl->out = g_string_new (NULL);
+	cl->sent = 0;
+	g_unix_fd_add (client_fd, G_IO_IN | G_IO_HUP | G_IO_ERR, server_client, cl);
+	return G_SOURCE_CONTINUE;
+}
 
-static PoEntry_set *
-po_set_create (GSList *po_list)
+static gboolean
+server_stop (gpointer data)
 {
-	GSList *l;
-	PoEntry_set *hash = g_hash_table_new (g_str_hash, g_str_equal);
-	for (l = po_list; l != NULL; l = l->next) {
-		PoEntry *po = l->data;
+	PoServer *srv = data;
 
-		g_hash_table_insert (hash, po->id->str, po);
-	}
-	return hash;
+	g_main_loop_quit (srv->loop);
+	return G_SOURCE_CONTINUE;
 }
 
-static PoEntry_set *
-po_set_update (PoEntry_set *po_set, GSList *po_list)
+static void
+potool_serve (const char *socket_fn, const char *cache_dir, int n_threads)
 {
-	GSList *l;
+	PoServer srv = { NULL };
+	struct sockaddr_un addr;
+	struct stat st;
+	int fd;
+
+	if (potool_connect (socket_fn) >= 0)
+		po_error (_("Another server is listening on %s"), socket_fn);
+	/* left behind by a server that was killed */
+	if (stat (socket_fn, &st) == 0 && S_ISSOCK (st.st_mode))
+		unlink (socket_fn);
+	if ((fd = potool_socket (socket_fn, &addr)) < 0 ||
+	    bind (fd, (struct sockaddr *) &addr, sizeof addr) < 0 || listen (fd, 16) < 0)
+		po_error (_("Can't listen on %s: %s"), socket_fn, g_strerror (errno));
+	/* files are rewritten while we run */
+	po_mapping_disable ();
+	if ((srv.inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC)) < 0)
+		po_error (_("Can't watch files: %s"), g_strerror (errno));
+	srv.loop = g_main_loop_new (NULL, FALSE);
+	srv.catalogs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, po_catalog_free);
+	srv.pool = po_pool_new ();
+	srv.cache_dir = cache_dir;
+	srv.n_threads = n_threads;
+	g_unix_set_fd_nonblocking (fd, TRUE, NULL);
+	g_unix_fd_add (fd, G_IO_IN, server_accept, &srv);
+	g_unix_fd_add (srv.inotify_fd, G_IO_IN, server_inotify, &srv);
+	g_unix_signal_add (SIGINT, server_stop, &srv);
+	g_unix_signal_add (SIGTERM, server_stop, &srv);
+
+	g_main_loop_run (srv.loop);
+
+	unlink (socket_fn);
+	close (fd);
+	close (srv.inotify_fd);
+	g_hash_table_destroy (srv.catalogs);
+	po_pool_free (srv.pool);
+	g_main_loop_unref (srv.loop);
+}
+
+#endif /* __linux__ */
 
-	for (l = po_list; l != NULL; l = l->next) {
-		PoEntry *po = (PoEntry *) l->data, *hpo;
+/* - */
 
-		if ((hpo = g_hash_table_lookup (po_set, po->id->str)) != NULL) {
-			po_entry_free_contents (hpo);
-			/* making a deep copy, since we are about to free po_list */
-			po_entry_copy (hpo, po);
+static void
+po_merge_entries (PoIndex *index, GArray *po_table)
+{
+	PoEntry *po = (PoEntry *) po_table->data, *end = po + po_table->len;
+
+	for (; po < end; po++) {
+		PoEntry *hpo;
+
+		if ((hpo = po_index_lookup (index, po)) != NULL) {
+			/* moving; the caller makes the base file adopt the memory */
+			*hpo = *po;
 		} else {
 			g_warning (_("Unknown msgid: %s"), po->id->str);
 		}
 	}
-	return po_set;
 }
 
 int
@@ -643,49 +1498,59 @@ main (int argc, char **argv)
 {
 	int c;
 	/* -- */
-	gboolean istats = FALSE;
+	PoStatsModes istats = NO_STATS;
+	gboolean merge_stats = FALSE;
 	gboolean copy_msgid = FALSE;
 	gboolean preserve_wrapping = FALSE;
 	PoFilters ifilters = 0;
 	po_write_modes write_mode = 0;
-
-	while ((c = getopt (argc, argv, "f:n:scph")) != EOF) {
+	int n_threads = 1;
+	const char *charset = NULL;
+	const char *cache_dir = getenv ("POTOOL_CACHE_DIR");
+	const char *mo_fn = NULL;
+	const char *serve_fn = NULL, *query_fn = NULL;
+	const char *entry_id = NULL;
+	int entry_n = 0;
+	GPtrArray *tm_fns = g_ptr_array_new ();
+	int tm_min = 80;
+	GString *query_opts = g_string_new (NULL);
+	GArray *sinks = g_array_new (FALSE, FALSE, sizeof (PoSink));
+
+	while ((c = getopt (argc, argv, "f:n:sSRbcpj:o:C:k:m:D:Q:g:G:P:t:T:h")) != EOF) {
+		/* passed on by -Q */
+		if (c == 'f' || c == 'n') {
+			g_string_append_printf (query_opts, " -%c%s", c, optarg);
+		} else if (strchr ("sSRp", c) != NULL) {
+			g_string_append_printf (query_opts, " -%c", c);
+		}
 		switch (c) {
 			case 'h' :
 				fprintf (stderr, _(
-				"Usage: %s FILENAME1 [FILENAME2] [FILTERS] [-s] [-c] [-p] [-h]\n"
+				"Usage: %s [FILENAME1 [FILENAME2]] [FILTERS] [-s|-S|-R] [-b] [-c] [-p] [-j THREADS] [-k CACHEDIR] [-C CHARSET] [-o FILE[:OPTIONS]]... [-t FILE]... [-T PERCENT] [-P text|json] [-h]\n"
+				"       %s -m MOFILE|DIRECTORY [-j THREADS] [-k CACHEDIR] [-C CHARSET] FILENAME...\n"
+				"       %s -D SOCKET [-j THREADS] [-k CACHEDIR]\n"
+				"       %s -Q SOCKET [OPTIONS] REQUEST [FILENAME [MSGID [MSGCTXT]]]\n"
+				"       %s -g N|-G MSGID [-n ...] [-p] [-j THREADS] [-k CACHEDIR] [FILENAME]\n"
 				"\n"
-				), argv[0]);
+				), argv[0], argv[0], argv[0], argv[0], argv[0]);
 				exit (EXIT_SUCCESS);
 				break;
 			case 'n' :
-				if (strcmp (optarg, "ctxt") == 0) {
-					write_mode |= NO_CTX;
-				} else if (strcmp (optarg, "id") == 0) {
-					write_mode |= NO_ID;
-				} else if (strcmp (optarg, "str") == 0) {
-					write_mode |= NO_STR;
-				} else if (strcmp (optarg, "cmt") == 0) {
-					write_mode |= NO_STD_COMMENT | NO_POS_COMMENT |
-					              NO_SPEC_COMMENT | NO_RES_COMMENT;
-				} else if (strcmp (optarg, "ucmt") == 0) {
-					write_mode |= NO_STD_COMMENT;
-				} else if (strcmp (optarg, "pcmt") == 0) {
-					write_mode |= NO_POS_COMMENT;
-				} else if (strcmp (optarg, "scmt") == 0) {
-					write_mode |= NO_SPEC_COMMENT;
-				} else if (strcmp (optarg, "dcmt") == 0) {
-					write_mode |= NO_RES_COMMENT;
-				} else if (strcmp (optarg, "tr") == 0) {
-					write_mode |= NO_TRANSLATION;
-				} else if (strcmp (optarg, "linf") == 0) {
-					write_mode |= NO_LINF;
-				} else {
-					po_error (_("Unknown parameter for -n option!"));
-				}
+				write_mode |= potool_write_mode (optarg);
 				break;
 			case 's' :
-				istats = TRUE;
+				if (istats == NO_STATS)
+					istats = COUNT_STATS;
+				break;
+			case 'S' :
+				if (istats != RAW_STATS)
+					istats = FULL_STATS;
+				break;
+			case 'R' :
+				istats = RAW_STATS;
+				break;
+			case 'b' :
+				merge_stats = TRUE;
 				break;
 			case 'c':
 				copy_msgid = TRUE;
@@ -693,24 +1558,50 @@ main (int argc, char **argv)
 			case 'p':
 				preserve_wrapping = TRUE;
 				break;
+			case 'j':
+				n_threads = atoi (optarg);
+				if (n_threads <= 0)
+					n_threads = g_get_num_processors ();
+				break;
 			case 'f' :
-				if (strcmp (optarg, "f") == 0) {
-					ifilters |= FUZZY_FILTER;
-				} else if (strcmp (optarg, "nf") == 0) {
-					ifilters |= NOT_FUZZY_FILTER;
-				} else if (strcmp (optarg, "t") == 0) {
-					ifilters |= TRANSLATED_FILTER;
-				} else if (strcmp (optarg, "nt") == 0) {
-					ifilters |= NOT_TRANSLATED_FILTER;
-				} else if (strcmp (optarg, "nth") == 0) {
-					ifilters |= NOT_TRANSLATED_H_FILTER;
-				} else if (strcmp (optarg, "o") == 0) {
-					ifilters |= OBSOLETE_FILTER;
-				} else if (strcmp (optarg, "no") == 0) {
-					ifilters |= NOT_OBSOLETE_FILTER;
-				} else {
-					po_error (_("Unknown filter \"%s\"!"), optarg);
-				}
+				ifilters |= potool_filter (optarg);
+				break;
+			case 'o' :
+				potool_add_sink (sinks, optarg);
+				break;
+			case 'C' :
+				charset = optarg;
+				break;
+			case 'k' :
+				cache_dir = optarg;
+				break;
+			case 'm' :
+				mo_fn = optarg;
+				break;
+			case 'D' :
+				serve_fn = optarg;
+				break;
+			case 'Q' :
+				query_fn = optarg;
+				break;
+			case 'g' :
+				entry_n = atoi (optarg);
+				if (entry_n <= 0)
+					po_error (_("Entries are numbered from 1!"));
+				break;
+			case 'G' :
+				entry_id = optarg;
+				break;
+			case 'P' :
+				potool_profile_start (optarg);
+				break;
+			case 't' :
+				g_ptr_array_add (tm_fns, optarg);
+				break;
+			case 'T' :
+				tm_min = atoi (optarg);
+				if (tm_min < 1 || tm_min > 100)
+					po_error (_("The similarity is a percentage, from 1 to 100!"));
 				break;
 			case ':' :
 				po_error (_("Invalid parameter!"));
@@ -723,45 +1614,149 @@ main (int argc, char **argv)
 		}
 	}
 
-	if (optind >= argc) {
-		po_error (_("Input file not specified!"));
-	}
-	if (argc - optind == 1) {
-		PoFile *pof;
-		char *ifn = argv[optind];
-
-		pof = po_read (ifn);
-		po_apply_filters (pof, ifilters);
+	if (cache_dir != NULL && *cache_dir == '\0')
+		cache_dir = NULL;
 
-		if (istats) {
-			potool_printf (_("%d\n"), g_slist_length (pof->entries));
+	if (serve_fn != NULL) {
+#ifdef __linux__
+		potool_serve (serve_fn, cache_dir, n_threads);
+#else
+		po_error (_("Serving needs inotify, which this system lacks"));
+#endif
+	} else if (query_fn != NULL) {
+		potool_query (query_fn, argv + optind, argc - optind, query_opts);
+	} else if (mo_fn != NULL) {
+		PoCompileOptions opts = { cache_dir, 1, ifilters, charset };
+		char *stdin_fn = "-";
+
+		potool_phase (PHASE_COMPILE);
+		if (optind < argc) {
+			potool_compile (argv + optind, argc - optind, mo_fn, n_threads, &opts);
 		} else {
-			if (copy_msgid) {
-				po_copy_msgid (pof);
+			potool_compile (&stdin_fn, 1, mo_fn, n_threads, &opts);
+		}
+	} else if (entry_n > 0 || entry_id != NULL) {
+		PoWriter pw;
+
+		po_writer_init (&pw, stdout, write_mode, preserve_wrapping);
+		potool_extract (optind < argc ? argv[optind] : "-", entry_n, entry_id, cache_dir, n_threads, &pw);
+	} else if (argc - optind <= 1) {
+		PoStream ps = { istats, copy_msgid, { 0 } };
+		char *ifn = optind < argc ? argv[optind] : "-";
+		GError *error = NULL;
+		int i;
+
+		if (merge_stats)
+			po_error (_("Option -b only works with two input files!"));
+		ps.sinks = sinks;
+		if (charset != NULL) {
+			ps.filters = ifilters;
+			ps.charset = charset;
+			ifilters = 0;
+		}
+		po_writer_init (&ps.writer, stdout, write_mode, preserve_wrapping);
+		potool_open_sinks (sinks, write_mode, preserve_wrapping);
+		potool_phase (PHASE_READ);
+		if (n_threads > 1 || tm_fns->len > 0 || (cache_dir != NULL && strcmp (ifn, "-") != 0)) {
+			/* the whole file has to be read first */
+			PoFile *pof = potool_read (ifn, cache_dir, n_threads, ifilters);
+
+			if (tm_fns->len > 0)
+				potool_suggest (pof, tm_fns, tm_min, cache_dir, n_threads);
+
+			potool_phase (PHASE_WRITE);
+			if (n_threads > 1) {
+				po_writer_start_thread (&ps.writer);
+				for (i = 0; i < sinks->len; i++) {
+					po_writer_start_thread (&g_array_index (sinks, PoSink, i).writer);
+				}
 			}
-			po_write (pof, write_mode, preserve_wrapping);
+			potool_stream_file (pof, &ps);
+			po_free (pof);
+		} else if (!po_parse_stream (ifn, ifilters, potool_stream_omit (&ps), po_stream_entry, &ps, &error)) {
+			/* keep the entries read so far */
+			po_writer_finish (&ps.writer);
+			potool_close_sinks (sinks);
+			po_error ("%s\n", error->message);
+		}
+		potool_phase (PHASE_WRITE);
+		potool_finish_write (&ps.writer);
+		potool_close_sinks (sinks);
+		potool_phase (PHASE_OTHER);
+		potool_stream_finish (&ps);
+		if (istats != NO_STATS) {
+			potool_phase (PHASE_STATS);
+			po_stats_print (&ps.stats, istats, stdout);
 		}
-		po_free (pof);
 	} else {
 		PoFile *bpof, *pof;
-		PoEntry_set *bpo_set;
+		PoIndex *bindex;
+		PoWriter pw;
 		char *bfn = argv[optind], *fn = argv[optind + 1];
 
-		bpof = po_read (bfn);
-		bpo_set = po_set_create (bpof->entries);
-		pof = po_read (fn);
-		po_apply_filters (pof, ifilters);
+		if (merge_stats && istats == NO_STATS)
+			istats = COUNT_STATS;
+		potool_phase (PHASE_READ);
+		bpof = potool_read (bfn, cache_dir, n_threads, 0);
+		potool_phase (PHASE_MERGE);
+		bindex = po_index_new (bpof->entries);
+		potool_phase (PHASE_READ);
+		pof = potool_read (fn, cache_dir, n_threads, ifilters);
+		potool_phase (PHASE_RECODE);
+		potool_recode_work (bpof, pof, fn);
+		potool_phase (PHASE_MERGE);
 		if (copy_msgid) {
 			po_copy_msgid (pof);
 		}
-		bpo_set = po_set_update (bpo_set, pof->entries);
-		po_write (bpof, write_mode, preserve_wrapping);
-		g_hash_table_destroy (bpo_set);
+		if (merge_stats) {
+			potool_phase (PHASE_STATS);
+			potool_file_stats (bpof, 0, istats, stdout);
+			potool_phase (PHASE_MERGE);
+		}
+		po_merge_entries (bindex, pof->entries);
+		po_adopt (bpof, pof);
+		if (tm_fns->len > 0) {
+			potool_suggest (bpof, tm_fns, tm_min, cache_dir, n_threads);
+		}
+		if (merge_stats) {
+			potool_phase (PHASE_STATS);
+			potool_file_stats (bpof, 0, istats, stdout);
+		}
+		if (charset != NULL) {
+			potool_phase (PHASE_RECODE);
+			potool_recode (bpof, charset, bfn);
+		}
+		potool_phase (PHASE_WRITE);
+		if (sinks->len > 0) {
+			PoStream ps = { NO_STATS };
+			int i;
+
+			ps.sinks = sinks;
+			potool_open_sinks (sinks, write_mode, preserve_wrapping);
+			for (i = 0; n_threads > 1 && i < sinks->len; i++) {
+				po_writer_start_thread (&g_array_index (sinks, PoSink, i).writer);
+			}
+			potool_stream_file (bpof, &ps);
+			potool_close_sinks (sinks);
+		} else if (!merge_stats) {
+			po_writer_init (&pw, stdout, write_mode, preserve_wrapping);
+			if (n_threads > 1) {
+				po_writer_start_thread (&pw);
+			}
+			po_write (&pw, bpof);
+			potool_finish_write (&pw);
+		}
+		potool_phase (PHASE_OTHER);
+		po_index_free (bindex);
 		po_free (bpof);
-		po_free (pof);
 	}
+	g_array_free (sinks, TRUE);
+	g_ptr_array_free (tm_fns, TRUE);
+	g_string_free (query_opts, TRUE);
 	if (fflush(stdout) != 0)
 		po_error(_("fflush(stdout) failed: %s"), strerror(errno));
+	potool_profile_print ();
 
 	return 0;
 }
+